@@ -0,0 +1,301 @@
+--[[
+回环端到端基准测试: 在本地启动测试服务器(见loopback_server.lua, 支持fork时在子进程运行),
+N个客户端各自保持window个在途消息, 收到回显后立即发送下一个。输出一行json:
+{"name":"loopback.conn","clients":10,"size":64,"window":1,"server":"fork","msgs":..,"reconnects":0,
+ "msgs_s":..,"mb_s":..,"p50_us":..,"p99_us":..,"p999_us":..,"cpu_us_msg":..}
+    msgs_s, mb_s: 每秒往返的消息数和消息字节数(单向)
+    p50_us, p99_us, p999_us: 从send_msg到recv_msg收到回显的往返耗时
+    cpu_us_msg: 客户端进程每个消息消耗的cpu时间, server为inproc时包括服务器
+
+lua bench/bench_loopback.lua [key=value ...]
+    mode=conn|sconn|network   默认conn, network需要sproto和sproto.sprotoparser
+    clients=10 size=64 window=1
+    duration=5 warmup=1       测量和预热的秒数, 预热期间的消息不计入结果
+    port=7540 nodelay=1
+    server=local|external     external时不启动测试服务器, 连接已经在port上运行的服务器,
+                              如 ./goscon_stub -p 7540 -d 65536 配合mode=sconn测试断线重连,
+                              sconn断线后自动重连, 输出中的reconnects为重连次数
+]]
+local socket = require "socket.c"
+local conn = require "conn"
+local sconn = require "sconn"
+local conn_group = require "conn_group"
+local loopback_server = require "bench.loopback_server"
+
+local gettime_us = socket.gettime_us
+
+local args = {
+    mode = "conn",
+    clients = 10,
+    size = 64,
+    window = 1,
+    duration = 5,
+    warmup = 1,
+    port = 7540,
+    nodelay = 1,
+    server = "local",
+}
+for i=1, select("#", ...) do
+    local arg = select(i, ...)
+    local k, v = arg:match("^(%w+)=(.*)$")
+    assert(k and args[k] ~= nil, "bad argument: "..arg)
+    args[k] = tonumber(v) or v
+end
+
+local HOST = "127.0.0.1"
+local mode = args.mode
+local size = args.size
+assert(size >= 8, "size should be at least 8 bytes for the timestamp")
+local options = args.nodelay ~= 0 and {nodelay = true} or nil
+sconn.set_verbose(false)
+
+
+-- network模式的协议: echo请求原样返回
+local PROTO_PACKAGE = ".package { type 0 : integer  session 1 : integer }\n"
+local PROTO_ECHO = "echo 1 { request { data 0 : string } response { data 0 : string } }\n"
+
+local function load_proto()
+    local ok, parser = pcall(require, "sproto.sprotoparser")
+    if not ok then
+        return nil
+    end
+    local sproto = require "sproto.sproto"
+    local client_bin = parser.parse(PROTO_PACKAGE)
+    local server_bin = parser.parse(PROTO_PACKAGE..PROTO_ECHO)
+    return client_bin, server_bin, sproto.new(server_bin)
+end
+
+
+--[[
+启动测试服务器, 返回:
+    pump(timeout): 服务器在本进程时驱动它, 否则为false
+    stop(): 关闭服务器
+]]
+local function start_server(proto)
+    if args.server == "external" then
+        return false, function () end
+    end
+    assert(args.server == "local", "bad server: "..tostring(args.server))
+
+    if not socket.fork then
+        local srv = assert(loopback_server.new(mode, HOST, args.port, proto))
+        srv:set_max_session(false)
+        return function (timeout) srv:update(timeout) end, function () end
+    end
+
+    local parent_sock, child_sock = assert(socket.socketpair())
+    io.stdout:flush()
+    local pid = assert(socket.fork())
+    if pid == 0 then
+        parent_sock:close()
+        local srv = assert(loopback_server.new(mode, HOST, args.port, proto))
+        srv:set_max_session(false)
+        child_sock:send("ready")
+        child_sock:setblocking(false)
+        while true do
+            srv:update(10)
+            -- 父进程关闭了socketpair
+            local data = child_sock:recv()
+            if data and #data == 0 then
+                break
+            end
+        end
+        os.exit(0)
+    end
+
+    child_sock:close()
+    assert(parent_sock:recv() == "ready", "server start failed")
+    return false, function ()
+        parent_sock:close()
+        socket.waitpid(pid)
+    end
+end
+
+
+local result = {
+    measuring = false,
+    msgs = 0,
+    rtt = {},
+    reconnects = 0,
+}
+
+local function record(rtt)
+    if result.measuring then
+        local n = result.msgs + 1
+        result.msgs = n
+        result.rtt[n] = rtt
+    end
+end
+
+
+local padding = string.rep("x", size - 8)
+
+local function new_msg()
+    return string.pack("<i8", gettime_us())..padding
+end
+
+
+-- conn/sconn: 消息的前8个字节是发送时间
+local function run_conn(pump, wait)
+    local out = {}
+    local stopping = false
+    local function handle(sock, success, err, status)
+        if not success then
+            -- sconn断线后重连, 重连成功后未收到的数据由服务器重发
+            if mode ~= "sconn" or not sock:reconnect() then
+                error(string.format("%s %s", err, status))
+            end
+            result.reconnects = result.reconnects + 1
+            return
+        end
+        local count = sock:recv_msg(out)
+        local now = gettime_us()
+        for i=1, count do
+            record(now - string.unpack("<i8", out[i]))
+            out[i] = nil
+            if not stopping then
+                sock:send_msg(new_msg())
+            end
+        end
+    end
+
+    local group = assert(conn_group.new(handle))
+    for _=1, args.clients do
+        local sock, err
+        if mode == "sconn" then
+            sock, err = sconn.connect_host(HOST, args.port, "", 0, options)
+        else
+            sock, err = conn.connect_host(HOST, args.port, options)
+        end
+        assert(sock, err)
+        group:add(sock)
+        for _=1, args.window do
+            sock:send_msg(new_msg())
+        end
+    end
+
+    wait(function ()
+        group:update(pump and 0 or 1)
+    end)
+    stopping = true
+    for _, sock in ipairs(group:clear()) do
+        sock:close()
+    end
+end
+
+
+-- network: 每个请求的回调记录往返时间
+local function run_network(pump, wait, client_bin, server_bin)
+    local network = require "network"
+    local poller = assert(socket.poller())
+    local payload = {data = string.rep("x", size)}
+    local nets = {}
+    local stopping = false
+
+    local function call(net)
+        local t = gettime_us()
+        net:call("echo", payload, function ()
+            record(gettime_us() - t)
+            if not stopping then
+                call(net)
+            end
+        end)
+    end
+
+    for i=1, args.clients do
+        local net = network(client_bin, server_bin)
+        assert(net:connect(HOST, args.port))
+        if options then
+            net.v_conn:set_options(options)
+        end
+        net.v_conn:attach_poller(poller, net)
+        nets[i] = net
+        for _=1, args.window do
+            call(net)
+        end
+    end
+
+    local ready, events = {}, {}
+    wait(function ()
+        local n = poller:wait(ready, events, pump and 0 or 1)
+        for i=1, n do
+            local success, err, status = ready[i]:update()
+            ready[i] = nil
+            if not success then
+                error(string.format("%s %s", err, status))
+            end
+        end
+    end)
+    stopping = true
+    for i=1, #nets do
+        nets[i].v_conn:close()
+    end
+    poller:close()
+end
+
+
+local function main()
+    local client_bin, server_bin, proto
+    if mode == "network" then
+        client_bin, server_bin, proto = load_proto()
+        if not client_bin then
+            print(string.format('{"name":"loopback.network","skipped":"sproto.sprotoparser not found"}'))
+            return
+        end
+    end
+
+    local pump, stop = start_server(proto)
+    local cpu_start, time_start
+
+    -- 预热warmup秒之后开始记录, 再运行duration秒
+    local function wait(step)
+        local start = gettime_us()
+        local warmup_end = start + args.warmup * 1000000
+        local stop_at = warmup_end + args.duration * 1000000
+        while true do
+            if pump then
+                pump(0)
+            end
+            step()
+
+            local now = gettime_us()
+            if not result.measuring and now >= warmup_end then
+                result.measuring = true
+                time_start = now
+                cpu_start = os.clock()
+            elseif now >= stop_at then
+                break
+            end
+        end
+        result.measuring = false
+        result.elapsed = gettime_us() - time_start
+        result.cpu = os.clock() - cpu_start
+    end
+
+    if mode == "network" then
+        run_network(pump, wait, client_bin, server_bin)
+    else
+        run_conn(pump, wait)
+    end
+    stop()
+
+    local rtt = result.rtt
+    local msgs = result.msgs
+    table.sort(rtt)
+    local function percentile(p)
+        if msgs == 0 then
+            return 0
+        end
+        return rtt[math.max(1, math.ceil(msgs * p))]
+    end
+
+    local seconds = result.elapsed / 1000000
+    print(string.format('{"name":"loopback.%s","clients":%d,"size":%d,"window":%d,"server":"%s",'
+        ..'"msgs":%d,"reconnects":%d,"msgs_s":%.1f,"mb_s":%.2f,"p50_us":%d,"p99_us":%d,"p999_us":%d,"cpu_us_msg":%.2f}',
+        mode, args.clients, size, args.window, args.server == "external" and "external" or pump and "inproc" or "fork",
+        msgs, result.reconnects, msgs / seconds, msgs * size / result.elapsed,
+        percentile(0.5), percentile(0.99), percentile(0.999),
+        msgs > 0 and result.cpu * 1000000 / msgs or 0))
+end
+
+main()
@@ -0,0 +1,226 @@
+-- 原生模块(socket.c, rc4.c, crypt)的微基准测试, 每个用例输出一行json:
+-- {"name":"rc4.crypt","bytes":1024,"iters":200000,"ns_op":812.5,"mb_s":1260.3}
+-- bytes为每次操作处理的字节数, 为0时mb_s为null
+-- 每个用例先预热, 再重复RUNS轮, 每轮至少运行min_ms毫秒, 取最快的一轮
+-- lua bench/bench_native.lua [pattern [min_ms]]
+local socket = require "socket.c"
+local rc4 = require "rc4.c"
+local crypt = require "crypt"
+local buffer = require "buffer.c"
+
+local pattern, min_ms = ...
+min_ms = tonumber(min_ms) or 200
+local RUNS = 5
+
+local gettime_us = socket.gettime_us
+
+math.randomseed(20240601)
+
+local function random_string(n)
+    local t = {}
+    for i=1, n do
+        t[i] = string.char(math.random(0, 255))
+    end
+    return table.concat(t)
+end
+
+
+-- 运行n次f, 返回耗时(微秒)
+local function run(f, n)
+    local t = gettime_us()
+    f(n)
+    return gettime_us() - t
+end
+
+
+local function bench(name, bytes, f)
+    if pattern and not name:find(pattern, 1, true) then
+        return
+    end
+
+    -- 预热并估算一轮需要的次数
+    local n = 1
+    while true do
+        local cost = run(f, n)
+        if cost >= min_ms * 1000 / 10 then
+            n = math.max(1, math.ceil(n * min_ms * 1000 / cost))
+            break
+        end
+        n = n * 2
+    end
+
+    local best = math.huge
+    for _=1, RUNS do
+        local cost = run(f, n)
+        if cost < best then
+            best = cost
+        end
+    end
+
+    local ns_op = best * 1000 / n
+    local mb_s = "null"
+    if bytes > 0 then
+        mb_s = string.format("%.1f", bytes * n / best)  -- bytes/us == MB/s
+    end
+    print(string.format('{"name":"%s","bytes":%d,"iters":%d,"ns_op":%.1f,"mb_s":%s}',
+        name, bytes, n, ns_op, mb_s))
+    io.stdout:flush()
+end
+
+
+local SIZES = {64, 1024, 16384}
+
+---------------- rc4 ----------------
+local rc4_key = random_string(32)
+for _, size in ipairs(SIZES) do
+    local data = random_string(size)
+    local c = rc4.rc4(rc4_key)
+    bench("rc4.crypt", size, function (n)
+        for _=1, n do
+            c:crypt(data)
+        end
+    end)
+end
+
+do
+    local size = 16384
+    local c = rc4.rc4(rc4_key)
+    local buf = buffer.create()
+    buf:push(random_string(size))
+    bench("rc4.crypt_buffer", size, function (n)
+        for _=1, n do
+            c:crypt_buffer(buf)
+        end
+    end)
+
+    -- 从一个buffer加密到另一个buffer, sconn收发的路径
+    local src = buffer.create()
+    local dst = buffer.create()
+    local data = random_string(size)
+    bench("rc4.crypt_to_buffer", size, function (n)
+        for _=1, n do
+            src:push(data)
+            c:crypt(src, dst)
+            dst:clear()
+        end
+    end)
+end
+
+---------------- crypt ----------------
+do
+    local key = crypt.randomkey()
+    local pub = crypt.dhexchange(crypt.randomkey())
+    -- 128位乘法和逐位乘法各跑一遍, 编译器不支持__int128时只有serial
+    local dhmul = crypt.dhmul()
+    for _, mul in ipairs {"serial", "int128"} do
+        if crypt.dhmul(mul) == mul then
+            bench("crypt.dhexchange."..mul, 0, function (n)
+                for _=1, n do
+                    crypt.dhexchange(key)
+                end
+            end)
+            bench("crypt.dhsecret."..mul, 0, function (n)
+                for _=1, n do
+                    crypt.dhsecret(pub, key)
+                end
+            end)
+        end
+    end
+    crypt.dhmul(dhmul)
+
+    local secret = crypt.dhsecret(pub, key)
+    local challenge = random_string(8)
+    bench("crypt.hmac64_md5", 8, function (n)
+        for _=1, n do
+            crypt.hmac64_md5(secret, challenge)
+        end
+    end)
+end
+
+-- base64/hex/xor在每个simd级别各跑一遍, scalar即不用向量指令的实现
+local SIMD_LEVELS = {"scalar", "sse", "avx2"}
+local simd = crypt.simd()
+for _, size in ipairs(SIZES) do
+    local data = random_string(size)
+    local encoded = crypt.base64encode(data)
+    local hex = crypt.hexencode(data)
+    local key = random_string(size)
+    local short_key = random_string(8)
+    for _, level in ipairs(SIMD_LEVELS) do
+        if crypt.simd(level) == level then
+            bench("crypt.base64encode."..level, size, function (n)
+                for _=1, n do
+                    crypt.base64encode(data)
+                end
+            end)
+            bench("crypt.base64decode."..level, size, function (n)
+                for _=1, n do
+                    crypt.base64decode(encoded)
+                end
+            end)
+            bench("crypt.base64decode_strict."..level, size, function (n)
+                for _=1, n do
+                    crypt.base64decode(encoded, true)
+                end
+            end)
+
+            bench("crypt.hexencode."..level, size, function (n)
+                for _=1, n do
+                    crypt.hexencode(data)
+                end
+            end)
+            bench("crypt.hexdecode."..level, size, function (n)
+                for _=1, n do
+                    crypt.hexdecode(hex)
+                end
+            end)
+
+            bench("crypt.xor_str."..level, size, function (n)
+                for _=1, n do
+                    crypt.xor_str(data, key)
+                end
+            end)
+            -- 短密钥循环使用
+            bench("crypt.xor_str_key8."..level, size, function (n)
+                for _=1, n do
+                    crypt.xor_str(data, short_key)
+                end
+            end)
+        end
+    end
+    crypt.simd(simd)
+end
+
+---------------- socket ----------------
+-- 一次send加一次recv, 两个系统调用
+if socket.socketpair then
+    local a, b = assert(socket.socketpair())
+    a:setblocking(false)
+    b:setblocking(false)
+
+    for _, size in ipairs {64, 4096} do
+        local data = random_string(size)
+        bench("socket.send_recv", size, function (n)
+            for _=1, n do
+                a:send(data)
+                b:recv(size)
+            end
+        end)
+    end
+
+    local size = 4096
+    local data = random_string(size)
+    local out = buffer.create()
+    local q = buffer.create()
+    bench("socket.sendv_recv_into", size, function (n)
+        for _=1, n do
+            q:push(data)
+            a:sendv(q)
+            b:recv_into(out, size)
+            out:clear()
+        end
+    end)
+
+    a:close()
+    b:close()
+end
@@ -0,0 +1,122 @@
+--[[
+bench_loopback用的本地测试服务器, 基于server.lua
+
+local srv = loopback_server.new(mode, host, port[, proto])
+    mode:
+        "conn": 原样回显收到的数据
+        "sconn": goscon协议的newconnect握手, 之后rc4解密再加密回显(不支持重连)
+        "network": 用proto(sproto对象)解析请求, 把请求原样作为回应
+srv:update(timeout)
+]]
+local server_new = require "server"
+local crypt = require "crypt"
+local rc4 = require "rc4.c"
+
+local DEF_MSG_HEADER_LEN = 2
+local DEF_MSG_ENDIAN = "little"
+
+
+local function echo(session, data)
+    session.v_send_buf:push(data)
+    session:update_send()
+    return true
+end
+
+
+-- goscon newconnect: 收到 "0\nbase64(DH_key)\ntarget\nflag", 回复 "id\nbase64(DH_key)"
+local function goscon_handshake(session, msg)
+    local ver, key = msg:match("^([^\n]*)\n([^\n]*)")
+    if ver ~= "0" then
+        return false
+    end
+
+    local serverkey = crypt.randomkey()
+    local secret = crypt.dhsecret(crypt.base64decode(key), serverkey)
+    local rc4_key
+        = crypt.hmac64_md5(secret, "\0\0\0\0\0\0\0\0")
+        ..crypt.hmac64_md5(secret, "\1\0\0\0\0\0\0\0")
+        ..crypt.hmac64_md5(secret, "\2\0\0\0\0\0\0\0")
+        ..crypt.hmac64_md5(secret, "\3\0\0\0\0\0\0\0")
+    session.v_c2s = rc4.rc4(rc4_key)
+    session.v_s2c = rc4.rc4(rc4_key)
+
+    local data = string.format("%d\n%s", session.o_idx, crypt.base64encode(crypt.dhexchange(serverkey)))
+    session.v_send_buf:push_block(data, 2, "big")
+    return true
+end
+
+
+local function goscon(session, data)
+    local recv_buf = session.v_recv_buf
+    if session.v_c2s == false then
+        return true
+    end
+    if not session.v_c2s then
+        recv_buf:push(data)
+        local msg = recv_buf:pop_block(2, "big")
+        if not msg then
+            return true
+        end
+        if not goscon_handshake(session, msg) then
+            -- 不支持重连, 之后的数据都丢弃
+            session.v_c2s = false
+            recv_buf:clear()
+            return true
+        end
+        if recv_buf:size() == 0 then
+            session:update_send()
+            return true
+        end
+        data = recv_buf:pop()
+    end
+
+    local plain = session.v_c2s:crypt(data)
+    session.v_send_buf:push(session.v_s2c:crypt(plain))
+    session:update_send()
+    return true
+end
+
+
+local function sproto_echo(host)
+    local out = {}
+    return function (session, data)
+        local recv_buf = session.v_recv_buf
+        recv_buf:push(data)
+        local count = recv_buf:pop_all_block(out, DEF_MSG_HEADER_LEN, DEF_MSG_ENDIAN)
+        for i=1, count do
+            local _type, _name, request, response = host:dispatch(out[i])
+            out[i] = nil
+            if response then
+                session.v_send_buf:push_block(response(request), DEF_MSG_HEADER_LEN, DEF_MSG_ENDIAN)
+            end
+        end
+        session:update_send()
+        return true
+    end
+end
+
+
+local function new(mode, host, port, proto)
+    local srv, err = server_new(host, port)
+    if not srv then
+        return nil, err
+    end
+
+    local handle
+    if mode == "conn" then
+        handle = echo
+    elseif mode == "sconn" then
+        handle = goscon
+    elseif mode == "network" then
+        handle = sproto_echo(proto:host "package")
+    else
+        error("unknown mode: "..tostring(mode))
+    end
+    srv:register_handle("recv", handle)
+    return srv
+end
+
+
+return {
+    new = new,
+}
@@ -1,5 +1,9 @@
 local socket = require "socket.c"
 local buffer_queue = require "buffer_queue"
+local stats = require "stats"
+
+local gettime_us = socket.gettime_us
+local observe = stats.observe
 
 local OK = 0
 local EINTR = socket.EINTR
@@ -8,127 +12,661 @@ local EINPROGRESS = socket.EINPROGRESS
 local ECONNREFUSED = socket.ECONNREFUSED
 local EISCONN = socket.EISCONN
 
+local EVENT_READ = socket.EVENT_READ
+local EVENT_WRITE = socket.EVENT_WRITE
+local EVENT_ERROR = socket.EVENT_ERROR
+
 local DEF_MSG_HEADER_LEN = 2
 local DEF_MSG_ENDIAN = "little"
 
+-- 每次update读取的预算, 见 mt:set_read_budget
+local DEF_READ_BUDGET_MODE = "eagain"
+local read_budget_mode = {
+    ["bytes"] = true,
+    ["reads"] = true,
+    ["eagain"] = true,
+}
+
+-- 异步域名解析, 见 connect_host
+local DEF_RESOLVE_TTL = 60*1000
+local resolve_ttl = DEF_RESOLVE_TTL
+local resolver = false
+local resolve_cache = {}    -- host -> {addrs = , expire = }
+local resolve_wait = {}     -- host -> 等待解析结果的conn数组
+local resolve_pending = 0
+local resolve_out = {}
+
+-- 多个地址时并行连接(happy eyeballs), 每隔connect_delay毫秒多发起一个连接
+local DEF_CONNECT_DELAY = 250
+local connect_delay = DEF_CONNECT_DELAY
+local racing = setmetatable({}, {__mode = "k"})
+
+--[[
+socket选项, 见 mt:set_options. 当前平台没有的选项会被忽略
+    nodelay: 关闭Nagle算法
+    quickack: 每次读取后重新设置TCP_QUICKACK, 不延迟ACK(linux)
+    keepalive: SO_KEEPALIVE
+    keepidle, keepintvl, keepcnt: keepalive的空闲时间(秒), 探测间隔(秒), 探测次数
+    user_timeout: 发送的数据多久(毫秒)没有被确认时断开连接(linux)
+    notsent_lowat: 内核中未发送数据的上限, 超过时不可写
+    sndbuf, rcvbuf: 发送/接收缓冲区大小
+]]
+local IPPROTO_TCP = socket.IPPROTO_TCP
+local SOL_SOCKET = socket.SOL_SOCKET
+local sock_options = {
+    nodelay = {IPPROTO_TCP, socket.TCP_NODELAY},
+    quickack = {IPPROTO_TCP, socket.TCP_QUICKACK},
+    keepalive = {SOL_SOCKET, socket.SO_KEEPALIVE},
+    keepidle = {IPPROTO_TCP, socket.TCP_KEEPIDLE},
+    keepintvl = {IPPROTO_TCP, socket.TCP_KEEPINTVL},
+    keepcnt = {IPPROTO_TCP, socket.TCP_KEEPCNT},
+    user_timeout = {IPPROTO_TCP, socket.TCP_USER_TIMEOUT},
+    notsent_lowat = {IPPROTO_TCP, socket.TCP_NOTSENT_LOWAT},
+    sndbuf = {SOL_SOCKET, socket.SO_SNDBUF},
+    rcvbuf = {SOL_SOCKET, socket.SO_RCVBUF},
+}
+
 local mt = {}
 
+local function new_stat()
+    return {
+        -- 已关闭的fd的i/o计数, 当前fd的计数在mt:stat时加上
+        recv_calls = 0,
+        send_calls = 0,
+        eagain = 0,
+        bytes_in = 0,
+        bytes_out = 0,
+
+        msgs_in = 0,
+        msgs_out = 0,
+        send_queue_max = 0,
+        recv_queue_max = 0,
+
+        connects = 0,
+        connect_us = stats.histogram(),
+        update_us = stats.histogram(),
+    }
+end
+
 local function conn_error(errcode)
     return socket.strerror(errcode).."["..tostring(errcode).."]"
 end
 
+local function gai_error(errcode)
+    return socket.gai_strerror(errcode).."["..tostring(errcode).."]"
+end
+
+-- 阻塞解析, 只在没有socket.resolver的平台使用
 local function resolve(host)
     local addr_tbl, err = socket.resolve(host)
     if not addr_tbl then
-        return false, socket.gai_strerror(err).."["..tostring(err).."]"
+        return false, gai_error(err)
     end
     return assert(addr_tbl[1])
 end
 
 
-local function connect(addr, port)
-    local fd = socket.socket(addr.family, socket.SOCK_STREAM, 0);
+local function numeric_addr(host)
+    if socket.normalize_ip(host) then
+        return {family = socket.AF_INET, addr = host}
+    elseif socket.normalize_ip(host, true) then
+        return {family = socket.AF_INET6, addr = host}
+    end
+end
+
+
+local function check_options(options)
+    for k in pairs(options) do
+        if not sock_options[k] then
+            return false, "unknown socket option: "..tostring(k)
+        end
+    end
+    return true
+end
+
+
+local function apply_options(fd, options)
+    if not options then
+        return true
+    end
+
+    for k, v in pairs(options) do
+        local opt = sock_options[k]
+        if opt[2] then
+            if v == true then
+                v = 1
+            elseif v == false then
+                v = 0
+            end
+            local ok, err = fd:setsockopt(opt[1], opt[2], v)
+            if not ok then
+                return false, k..": "..conn_error(err)
+            end
+        end
+    end
+    return true
+end
+
+
+local function new_conn(port, options)
+    local raw = {
+        v_send_buf = buffer_queue.create(),
+        v_recv_buf = buffer_queue.create(),
+        v_fd = false,
+
+        o_host_addr = false,
+        o_port = port,
+        v_check_connect = true,
+
+        -- 每个新的fd在连接前设置的socket选项
+        v_options = options or false,
+        v_quickack = options and options.quickack and socket.TCP_QUICKACK or false,
+
+        -- 正在解析的域名, 解析失败时的错误
+        v_resolving = false,
+        v_error = false,
+
+        -- 并行连接中的 {fd=, addr=} 和还没有尝试的地址
+        v_attempts = false,
+        v_candidates = false,
+        v_next_attempt = 0,
+
+        v_poller = false,
+        v_poll_obj = false,
+        v_poll_events = false,
+
+        v_read_budget_mode = DEF_READ_BUDGET_MODE,
+        v_read_max_bytes = 0,
+        v_read_max_reads = 0,
+        v_read_count = 0,
+        v_read_budget_hit = 0,
+
+        v_stat = new_stat(),
+        v_connect_start = gettime_us(),
+    }
+    return setmetatable(raw, {__index = mt})
+end
+
+
+-- 创建非阻塞socket并发起连接
+local function open_fd(addr, port, options)
+    local fd = socket.socket(addr.family, socket.SOCK_STREAM, 0)
     fd:setblocking(false)
 
+    local ok, err = apply_options(fd, options)
+    if not ok then
+        fd:close()
+        return nil, err
+    end
+
     local errcode = fd:connect(addr.addr, port)
     if errcode == OK or
        errcode == EAGAIN or
        errcode == EINPROGRESS or
        errcode == EINTR or 
        errcode == EISCONN  then
-       local raw = {
-            v_send_buf = buffer_queue.create(),
-            v_recv_buf = buffer_queue.create(),
-            v_fd = fd,
-
-            o_host_addr = addr,
-            o_port = port,
-            v_check_connect = true,
-       }
-       return setmetatable(raw, {__index = mt})
-   else
+       return fd
+    else
+       fd:close()
        return nil, conn_error(errcode)
-   end
+    end
 end
 
 
-local function connect_host(host, port)
-    local addr, err = resolve(host)
-    if not addr then
-        return false, err
+-- 换上新的连接中的fd, 已注册poller时同时替换poller中的fd
+local function set_fd(self, fd, addr, port)
+    local poller = self.v_poller
+    if poller then
+        if self.v_fd then
+            poller:del(self.v_fd)
+        end
+        poller:add(fd, EVENT_WRITE, self.v_poll_obj)
+        self.v_poll_events = EVENT_WRITE
     end
+    self.v_fd = fd
+    self.o_host_addr = addr
+    self.o_port = port
+    self.v_check_connect = true
+end
 
-    return connect(addr, port)
+
+local function add_io_stat(st, fd)
+    local io = fd:stat()
+    st.recv_calls = st.recv_calls + io.recv_calls
+    st.send_calls = st.send_calls + io.send_calls
+    st.eagain = st.eagain + io.eagain
+    st.bytes_in = st.bytes_in + io.bytes_in
+    st.bytes_out = st.bytes_out + io.bytes_out
 end
 
-local function _flush_send(self)
-    local send_buf = self.v_send_buf
-    local v = send_buf:get_head_data()
-    local fd = self.v_fd
-    local count = 0
 
-    while v do
-        local len = #v
-        local n, err = fd:send(v)
-        if not n then
-            if err == EAGAIN or err == EINTR then
-                break
+-- 关闭fd, i/o计数累加到conn的统计上
+local function close_fd(self, fd)
+    add_io_stat(self.v_stat, fd)
+    fd:close()
+end
+
+
+-- 连接完成, 记录从发起连接(包括域名解析)到完成的时间
+local function on_connected(self)
+    local st = self.v_stat
+    st.connects = st.connects + 1
+    observe(st.connect_us, gettime_us() - self.v_connect_start)
+end
+
+
+local function connect(addr, port, options)
+    if options then
+        local ok, err = check_options(options)
+        if not ok then
+            return nil, err
+        end
+    end
+
+    local fd, err = open_fd(addr, port, options)
+    if not fd then
+        return nil, err
+    end
+
+    local self = new_conn(port, options)
+    set_fd(self, fd, addr, port)
+    return self
+end
+
+
+-- 不同地址族交替排列, 以第一个地址的地址族开头
+local function interleave(addrs)
+    local first = addrs[1].family
+    local a, b = {}, {}
+    for i=1, #addrs do
+        local addr = addrs[i]
+        if addr.family == first then
+            a[#a+1] = addr
+        else
+            b[#b+1] = addr
+        end
+    end
+
+    local ret = {}
+    for i=1, math.max(#a, #b) do
+        ret[#ret+1] = a[i]
+        ret[#ret+1] = b[i]
+    end
+    return ret
+end
+
+
+-- 发起下一个地址的连接, 立即失败的地址直接跳过
+local function start_attempt(self)
+    local candidates = self.v_candidates
+    while #candidates > 0 do
+        local addr = table.remove(candidates, 1)
+        local fd, err = open_fd(addr, self.o_port, self.v_options)
+        if fd then
+            local poller = self.v_poller
+            if poller then
+                poller:add(fd, EVENT_WRITE, self.v_poll_obj)
             end
-            return false, conn_error(err)
+            local attempts = self.v_attempts
+            attempts[#attempts+1] = {fd = fd, addr = addr}
+            self.v_next_attempt = socket.gettime() + connect_delay
+            return true
+        end
+        self.v_error = err
+    end
+    return false
+end
+
+
+local function close_attempt(self, attempt)
+    local poller = self.v_poller
+    if poller then
+        poller:del(attempt.fd)
+    end
+    close_fd(self, attempt.fd)
+end
+
+
+local function stop_race(self)
+    local attempts = self.v_attempts
+    if attempts then
+        for i=1, #attempts do
+            close_attempt(self, attempts[i])
+        end
+    end
+    self.v_attempts = false
+    self.v_candidates = false
+    racing[self] = nil
+end
+
+
+local function connect_addrs(self, addrs)
+    if #addrs == 1 then
+        local addr = addrs[1]
+        local fd, err = open_fd(addr, self.o_port, self.v_options)
+        if not fd then
+            self.v_error = err
+            return
+        end
+        set_fd(self, fd, addr, self.o_port)
+        return
+    end
+
+    self.v_attempts = {}
+    self.v_candidates = interleave(addrs)
+    racing[self] = true
+    start_attempt(self)
+end
+
+
+--[[
+并行连接的状态, 返回:
+    true: 有一个连接成功, 成为conn的fd
+    false, err: 所有地址都失败
+    nil: 还在连接中
+]]
+local function check_race(self)
+    local attempts = self.v_attempts
+    for i=#attempts, 1, -1 do
+        local attempt = attempts[i]
+        local success, err = attempt.fd:check_async_connect()
+        if success then
+            table.remove(attempts, i)
+            stop_race(self)
+
+            self.v_fd = attempt.fd
+            self.o_host_addr = attempt.addr
+            self.v_check_connect = false
+            self.v_error = false
+            if self.v_poller then
+                self.v_poll_events = EVENT_WRITE
+            end
+            on_connected(self)
+            return true
+        elseif err then
+            table.remove(attempts, i)
+            close_attempt(self, attempt)
+            self.v_error = conn_error(err)
+        end
+    end
+
+    if #attempts == 0 or socket.gettime() >= self.v_next_attempt then
+        start_attempt(self)
+    end
+    if #attempts == 0 then
+        stop_race(self)
+        return false, self.v_error or "connect failed"
+    end
+end
+
+
+--[[
+到时间的并行连接发起下一个地址的连接。
+conn:update在连接期间会调用, 用poller驱动时需要定时调用(conn_group:update已经调用)
+]]
+local function update_connecting()
+    if not next(racing) then
+        return
+    end
+
+    local now = socket.gettime()
+    for c in pairs(racing) do
+        if now >= c.v_next_attempt then
+            start_attempt(c)
+        end
+    end
+end
+
+
+--[[
+距离最早一个到期的并行连接还有多少毫秒, 到期时需要调用update_connecting。
+没有等待发起的连接时返回nil
+]]
+local function next_attempt_wait()
+    local deadline
+    for c in pairs(racing) do
+        local candidates = c.v_candidates
+        if candidates and #candidates > 0 then
+            local t = c.v_next_attempt
+            if not deadline or t < deadline then
+                deadline = t
+            end
+        end
+    end
+    if not deadline then
+        return nil
+    end
+    local wait = deadline - socket.gettime()
+    return wait > 0 and wait or 0
+end
+
+
+local function on_resolved(self, addrs, err)
+    if not self.v_resolving then
+        -- 解析期间被关闭
+        return
+    end
+    self.v_resolving = false
+
+    if not addrs then
+        self.v_error = err
+        return
+    end
+    connect_addrs(self, addrs)
+end
+
+
+--[[
+收集已完成的异步解析, 为等待的conn发起连接。
+conn:update在解析期间会调用它, 用poller驱动时可以把resolve_socket()注册到poller上,
+可读时调用。
+out: 可选参数, 填入收到解析结果的conn
+返回收到解析结果的conn数
+]]
+local function update_resolve(out)
+    if resolve_pending == 0 then
+        return 0
+    end
+
+    local result = resolve_out
+    local n = resolver:poll(result)
+    local now = socket.gettime()
+    local count = 0
+    for i=1, n do
+        local v = result[i]
+        result[i] = nil
+
+        local host = v.host
+        local addrs = v.addrs
+        local err
+        if addrs and #addrs > 0 then
+            resolve_cache[host] = {addrs = addrs, expire = now + resolve_ttl}
         else
-            count = count + n
-            send_buf:pop(n)
-            if n < len then
-                break
+            addrs = nil
+            err = v.err and gai_error(v.err) or "no address"
+        end
+
+        local wait = resolve_wait[host]
+        resolve_wait[host] = nil
+        resolve_pending = resolve_pending - 1
+        for j=1, #wait do
+            local c = wait[j]
+            on_resolved(c, addrs, err)
+            count = count + 1
+            if out then
+                out[count] = c
             end
         end
-        v = send_buf:get_head_data()
     end
     return count
 end
 
 
+-- 解析完成时可读的socket, 不支持异步解析的平台返回nil
+local function resolve_socket()
+    if not socket.resolver then
+        return nil
+    end
+    if not resolver then
+        resolver = assert(socket.resolver())
+    end
+    return resolver:socket()
+end
+
+
+-- 解析结果的缓存时间(毫秒)
+local function set_resolve_ttl(ttl)
+    resolve_ttl = ttl
+end
+
+
+-- 并行连接时发起下一个地址前等待的毫秒数
+local function set_connect_delay(delay)
+    connect_delay = delay
+end
+
+
+local function clear_resolve_cache()
+    resolve_cache = {}
+end
+
+
+--[[
+host为域名时不会阻塞: 命中缓存时直接连接, 否则返回的conn处于解析状态,
+update返回 true, nil, "connect" 直到解析完成并发起连接, 解析失败时update返回错误。
+options: 可选参数, socket选项, 见 mt:set_options
+]]
+local function connect_host(host, port, options)
+    local addr = numeric_addr(host)
+    if addr then
+        return connect(addr, port, options)
+    end
+
+    if options then
+        local ok, err = check_options(options)
+        if not ok then
+            return nil, err
+        end
+    end
+
+    local addrs
+    local entry = resolve_cache[host]
+    if entry and entry.expire > socket.gettime() then
+        addrs = entry.addrs
+    elseif not resolve_socket() then
+        local err
+        addrs, err = socket.resolve(host)
+        if not addrs then
+            return false, gai_error(err)
+        end
+        if #addrs == 0 then
+            return false, "no address"
+        end
+    end
+
+    if addrs then
+        local self = new_conn(port, options)
+        connect_addrs(self, addrs)
+        if not self.v_fd and not self.v_attempts then
+            return false, self.v_error
+        end
+        return self
+    end
+
+    local wait = resolve_wait[host]
+    if not wait then
+        local id, err = resolver:query(host)
+        if not id then
+            return false, conn_error(err)
+        end
+        wait = {}
+        resolve_wait[host] = wait
+        resolve_pending = resolve_pending + 1
+    end
+
+    local self = new_conn(port, options)
+    self.v_resolving = host
+    wait[#wait+1] = self
+    return self
+end
+
+local function _flush_send(self)
+    local send_buf = self.v_send_buf
+    if send_buf:size() == 0 then
+        return 0
+    end
+
+    -- 一次系统调用发送整个发送队列, 已发送的部分从队列中移除
+    local n, err = self.v_fd:sendv(send_buf)
+    if not n then
+        if err == EAGAIN or err == EINTR then
+            return 0
+        end
+        return false, conn_error(err)
+    end
+    return n
+end
+
+
+local function _check_send_queue(self)
+    local size = self.v_send_buf:size()
+    local st = self.v_stat
+    if size > st.send_queue_max then
+        st.send_queue_max = size
+    end
+end
+
+
 local function _flush_recv(self)
     local recv_buf = self.v_recv_buf
     local fd = self.v_fd
-    local count = 0
 
-    while true do
-    ::CONTINUE::
-        local data, err = fd:recv()
-        if not data then
-            if err == EAGAIN or err == 0 then
-                return true
-            elseif err == EINTR then
-                goto CONTINUE
-            else
-                return false, conn_error(err)
-            end
-        elseif #data == 0 then
-            return false, "connect_break"
+    -- 直接读入接收缓冲区, 读到EAGAIN或者用完预算为止
+    -- 成功时第二个返回值是budget_hit, 失败时(n为nil)是errno
+    local n, hit_or_errno = fd:recv_into(recv_buf, self.v_read_max_bytes, self.v_read_max_reads)
+    if not n then
+        local errno = hit_or_errno
+        if errno == EAGAIN or errno == EINTR then
+            return true
         else
-            local len = #data
-            count = count + len
-            recv_buf:push(data)
-            break
+            return false, conn_error(errno)
         end
+    elseif n == 0 then
+        return false, "connect_break"
     end
 
-    return count
+    if self.v_quickack then
+        fd:setsockopt(IPPROTO_TCP, self.v_quickack, 1)
+    end
+
+    local size = recv_buf:size()
+    local st = self.v_stat
+    if size > st.recv_queue_max then
+        st.recv_queue_max = size
+    end
+
+    self.v_read_count = self.v_read_count + 1
+    local budget_hit = hit_or_errno
+    if budget_hit then
+        -- 预算用完, 内核中可能还有数据
+        self.v_read_budget_hit = self.v_read_budget_hit + 1
+    end
+    return n
 end
 
-local function _check_connect(self)
+local function _check_connect(self, ready)
     local fd = self.v_fd
     if not fd then
         return false, 'fd is nil'
     end
 
     if self.v_check_connect then
-        local success, err = fd:check_async_connect()
+        local success, err = fd:check_async_connect(ready)
         if not success then
             return false, err and conn_error(err) or "connecting"
         else
             self.v_check_connect = false
+            on_connected(self)
             return true
         end
     else
@@ -137,6 +675,29 @@ local function _check_connect(self)
 end
 
 
+-- 根据当前状态同步poller关注的事件
+local function _sync_poll(self)
+    local poller = self.v_poller
+    local fd = self.v_fd
+    if not poller or not fd then
+        return
+    end
+
+    local events
+    if self.v_check_connect then
+        events = EVENT_WRITE
+    elseif self.v_send_buf:size() > 0 then
+        events = EVENT_READ | EVENT_WRITE
+    else
+        events = EVENT_READ
+    end
+
+    if events ~= self.v_poll_events then
+        poller:mod(fd, events)
+        self.v_poll_events = events
+    end
+end
+
 
 function mt:send_msg(data, header_len, endian)
     local send_buf = self.v_send_buf
@@ -144,16 +705,38 @@ function mt:send_msg(data, header_len, endian)
     endian = endian or DEF_MSG_ENDIAN
 
     send_buf:push_block(data, header_len, endian)
+    local st = self.v_stat
+    st.msgs_out = st.msgs_out + 1
+    _check_send_queue(self)
+    _sync_poll(self)
 end
 
 
 
-function mt:recv_msg(out_msg, header_len, endian)
+-- 一次添加多个消息, 只做一次缓冲区扩容
+function mt:send_msgs(list, header_len, endian)
+    local send_buf = self.v_send_buf
+    header_len = header_len or DEF_MSG_HEADER_LEN
+    endian = endian or DEF_MSG_ENDIAN
+
+    send_buf:push_blocks(list, header_len, endian)
+    local st = self.v_stat
+    st.msgs_out = st.msgs_out + #list
+    _check_send_queue(self)
+    _sync_poll(self)
+end
+
+
+-- max: 可选参数, 最多取出的消息个数
+function mt:recv_msg(out_msg, header_len, endian, max)
     local recv_buf = self.v_recv_buf
     header_len = header_len or DEF_MSG_HEADER_LEN
     endian = endian or DEF_MSG_ENDIAN
 
-    return recv_buf:pop_all_block(out_msg, header_len, endian)
+    local count = recv_buf:pop_all_block(out_msg, header_len, endian, max)
+    local st = self.v_stat
+    st.msgs_in = st.msgs_in + count
+    return count
 end
 
 function mt:pop_msg(header_len, endian)
@@ -161,12 +744,27 @@ function mt:pop_msg(header_len, endian)
     header_len = header_len or DEF_MSG_HEADER_LEN
     endian = endian or DEF_MSG_ENDIAN
 
-    return recv_buf:pop_block(header_len, endian)
+    local msg = recv_buf:pop_block(header_len, endian)
+    if msg then
+        local st = self.v_stat
+        st.msgs_in = st.msgs_in + 1
+    end
+    return msg
 end
 
 
 function mt:send(data)
    self.v_send_buf:push(data)
+   _check_send_queue(self)
+   _sync_poll(self)
+end
+
+
+-- 把buf中最新的nbytes加入发送队列, buf不变
+function mt:send_tail(buf, nbytes)
+    buf:copy_tail(self.v_send_buf, nbytes)
+    _check_send_queue(self)
+    _sync_poll(self)
 end
 
 
@@ -177,6 +775,12 @@ function mt:recv(out)
 end
 
 
+-- 返回接收缓冲区(buffer_queue), 调用者直接从中取走数据, 如sconn把它解密到自己的缓冲区
+function mt:recv_buffer()
+    return self.v_recv_buf
+end
+
+
 
 --[[
 update 接口现在会返回三个参数 success, err, status
@@ -193,15 +797,51 @@ status: string类型 当前sconn所在的状态，状态只能是:
     "recv": 接受状态数据状态
     "send": 发送数据状态
     "close": 关闭状态
+
+events: 可选参数, poller:wait返回的就绪事件。
+    传入时只处理就绪的读写, 不传时每次都尝试收发。
 ]]
 
-function mt:update()
+local function _update(self, events)
     local fd = self.v_fd
     if not fd then
-        return false, "fd is nil", "close"
+        if self.v_resolving then
+            update_resolve()
+            if self.v_resolving then
+                return true, nil, "connect"
+            end
+            -- 刚发起连接, 这次的events不是这个fd的
+            events = nil
+        end
+        if self.v_attempts then
+            local success, err = check_race(self)
+            if success == nil then
+                return true, nil, "connect"
+            elseif not success then
+                return false, err, "connect"
+            end
+            events = nil
+        end
+        fd = self.v_fd
+        if not fd then
+            if self.v_error then
+                return false, self.v_error, "connect"
+            end
+            return false, "fd is nil", "close"
+        end
     end
 
-    local success, err = _check_connect(self)
+    local readable, writable, ready = true, true, nil
+    if events then
+        readable = events & (EVENT_READ | EVENT_ERROR) ~= 0
+        writable = events & (EVENT_WRITE | EVENT_ERROR) ~= 0
+        ready = writable
+        if self.v_check_connect and not ready then
+            return true, nil, "connect"
+        end
+    end
+
+    local success, err = _check_connect(self, ready)
     if not success then
         if err == "connecting" then
             return true, nil, "connect"
@@ -210,25 +850,178 @@ function mt:update()
         end
     end
 
-    success, err = _flush_send(self)
-    if not success then
-        return false, err, "send"
+    if writable then
+        success, err = _flush_send(self)
+        if not success then
+            return false, err, "send"
+        end
     end
 
-    success, err = _flush_recv(self)
-    if not success then
-        if err == "connect_break" then
-            return false, "connect break", "connect_break"
-        else
-            return false, err, "recv"
+    if readable then
+        success, err = _flush_recv(self)
+        if not success then
+            if err == "connect_break" then
+                return false, "connect break", "connect_break"
+            else
+                return false, err, "recv"
+            end
         end
     end
 
+    _sync_poll(self)
     return true, nil, "forward"
 end
 
 
+function mt:update(events)
+    local t = gettime_us()
+    local success, err, status = _update(self, events)
+    observe(self.v_stat.update_us, gettime_us() - t)
+    return success, err, status
+end
+
+
+--[[
+把连接注册到poller上, 之后由poller:wait驱动update(events)。
+obj: poller:wait返回的对象, 默认为conn自身
+]]
+function mt:attach_poller(poller, obj)
+    assert(not self.v_poller, "already attached")
+    obj = obj or self
+    local events = self.v_check_connect and EVENT_WRITE or EVENT_READ
+    if self.v_fd then
+        local errcode = poller:add(self.v_fd, events, obj)
+        if errcode ~= OK then
+            return false, conn_error(errcode)
+        end
+    end
+    local attempts = self.v_attempts
+    if attempts then
+        for i=1, #attempts do
+            poller:add(attempts[i].fd, EVENT_WRITE, obj)
+        end
+    end
+    self.v_poller = poller
+    self.v_poll_obj = obj
+    self.v_poll_events = events
+    _sync_poll(self)
+    return true
+end
+
+
+function mt:detach_poller()
+    local poller = self.v_poller
+    if poller and self.v_fd then
+        poller:del(self.v_fd)
+    end
+    local attempts = self.v_attempts
+    if poller and attempts then
+        for i=1, #attempts do
+            poller:del(attempts[i].fd)
+        end
+    end
+    self.v_poller = false
+    self.v_poll_obj = false
+    self.v_poll_events = false
+end
+
+
+--[[
+设置每次update的读取预算
+mode: 
+    "bytes": 每次update最多读取n个字节
+    "reads": 每次update最多调用n次recv
+    "eagain": 一直读到EAGAIN为止(默认)
+]]
+function mt:set_read_budget(mode, n)
+    assert(read_budget_mode[mode], mode)
+    local max_bytes, max_reads = 0, 0
+    if mode == "bytes" then
+        max_bytes = assert(n)
+        assert(max_bytes > 0)
+    elseif mode == "reads" then
+        max_reads = assert(n)
+        assert(max_reads > 0)
+    end
+    self.v_read_budget_mode = mode
+    self.v_read_max_bytes = max_bytes
+    self.v_read_max_reads = max_reads
+end
+
+
+--[[
+返回读取预算的统计:
+    mode: 当前预算模式
+    reads: 读到数据的update次数
+    budget_hit: 因为预算用完而停止读取的次数
+]]
+function mt:read_budget_stat()
+    return {
+        mode = self.v_read_budget_mode,
+        reads = self.v_read_count,
+        budget_hit = self.v_read_budget_hit,
+    }
+end
+
+
+--[[
+设置socket选项, 立即作用于当前的fd, 之后重连(new_connect)和并行连接的fd在连接前设置。
+options: {nodelay = true, keepidle = 30, ...}, 可用的选项见 sock_options
+]]
+function mt:set_options(options)
+    local ok, err = check_options(options)
+    if not ok then
+        return false, err
+    end
+
+    self.v_options = options
+    self.v_quickack = options.quickack and socket.TCP_QUICKACK or false
+    if self.v_fd then
+        ok, err = apply_options(self.v_fd, options)
+        if not ok then
+            return false, err
+        end
+    end
+    local attempts = self.v_attempts
+    if attempts then
+        for i=1, #attempts do
+            apply_options(attempts[i].fd, options)
+        end
+    end
+    return true
+end
+
+
+--[[
+返回连接统计的快照, 可以用stats.merge汇总多个连接:
+    bytes_in, bytes_out: 收发的字节数
+    msgs_in, msgs_out: 收发的消息数(send_msg/send_msgs/recv_msg/pop_msg)
+    recv_calls, send_calls: 收发的系统调用次数
+    eagain: 返回EAGAIN的系统调用次数
+    send_queue, recv_queue: 当前发送/接收队列的字节数
+    send_queue_max, recv_queue_max: 发送/接收队列的最大字节数
+    connects: 连接成功的次数(包括new_connect重连)
+    connect_us: 发起连接到连接完成的耗时直方图(微秒), 包括域名解析
+    update_us: update的耗时直方图(微秒)
+    reads, budget_hit: 同read_budget_stat
+]]
+function mt:stat()
+    local st = stats.copy(self.v_stat)
+    if self.v_fd then
+        add_io_stat(st, self.v_fd)
+    end
+    st.send_queue = self.v_send_buf:size()
+    st.recv_queue = self.v_recv_buf:size()
+    st.reads = self.v_read_count
+    st.budget_hit = self.v_read_budget_hit
+    return st
+end
+
+
 function mt:flush_send()
+    if not self.v_fd then
+        return
+    end
     local count = false
     repeat
         count = _flush_send(self)
@@ -241,31 +1034,33 @@ end
 
 
 function mt:new_connect(addr, port)
-    local fd = socket.socket(addr.family, socket.SOCK_STREAM, 0)
-    fd:setblocking(false)
+    local fd, err = open_fd(addr, port, self.v_options)
+    if not fd then
+        return false, err
+    end
 
-    local errcode = fd:connect(addr.addr, port)
-    if errcode == OK or
-       errcode == EAGAIN or
-       errcode == EINPROGRESS or
-       errcode == EINTR or 
-       errcode == EISCONN  then
-       self.v_fd:close()
-       self.v_recv_buf:clear()
-       self.v_send_buf:clear()
-       self.v_fd = fd
-       self.o_host_addr = addr
-       self.o_port = port
-       self.v_check_connect = true
-       return true
-    else
-        return false, conn_error(errcode)
+    local old_fd = self.v_fd
+    set_fd(self, fd, addr, port)
+    if old_fd then
+        close_fd(self, old_fd)
     end
+    self.v_connect_start = gettime_us()
+    self.v_recv_buf:clear()
+    self.v_send_buf:clear()
+    self.v_resolving = false
+    self.v_error = false
+    stop_race(self)
+    return true
 end
 
 function mt:close()
+    self.v_resolving = false
+    stop_race(self)
     self:flush_send()
-    self.v_fd:close()
+    self:detach_poller()
+    if self.v_fd then
+        close_fd(self, self.v_fd)
+    end
     self.v_fd = nil
     self.v_check_connect = true
 end
@@ -275,4 +1070,11 @@ return {
     resolve = resolve,
     connect = connect,
     connect_host = connect_host,
+    update_resolve = update_resolve,
+    update_connecting = update_connecting,
+    next_attempt_wait = next_attempt_wait,
+    set_connect_delay = set_connect_delay,
+    resolve_socket = resolve_socket,
+    set_resolve_ttl = set_resolve_ttl,
+    clear_resolve_cache = clear_resolve_cache,
 }
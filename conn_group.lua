@@ -0,0 +1,252 @@
+local socket = require "socket.c"
+local conn = require "conn"
+local stats = require "stats"
+
+local EVENT_READ = socket.EVENT_READ
+
+-- poller:wait返回它时表示有异步解析完成
+local RESOLVE_OBJ = {}
+
+-- poller -> group, 解析结果是所有group共享的, 失败的连接要交给它所在的group报告
+local groups = setmetatable({}, {__mode = "k"})
+
+local mt = {}
+mt.__index = mt
+
+--[[
+conn_group 管理大量conn/sconn连接, 一次poller:wait只更新就绪的连接.
+
+local group = conn_group.new(handle)
+group:add(sock)
+group:remove(sock)
+group:update(timeout)   -- 返回本次更新的连接数
+group:stat()
+group:conn_stat()       -- 所有连接stat()的汇总
+
+handle(sock, success, err, status): 每个被更新的连接调用一次, 参数为sock:update的返回值。
+没有poller的平台退化为每次update所有连接。
+]]
+
+local function new(handle)
+    local self = {
+        v_poller = false,
+        v_handle = handle or false,
+
+        -- 连接数组 + 连接到下标的索引, 删除时与末尾交换
+        v_list = {},
+        v_index = {},
+
+        v_ready = {},
+        v_ready_events = {},
+        v_resolved = {},
+        -- 解析失败等待在下次update里报告的连接
+        v_failed = {},
+
+        v_waits = 0,
+        v_updates = 0,
+        v_errors = 0,
+        v_last_ready = 0,
+    }
+
+    if socket.poller then
+        local poller, err = socket.poller()
+        if not poller then
+            return nil, err
+        end
+        self.v_poller = poller
+        groups[poller] = self
+
+        local resolve_sock = conn.resolve_socket()
+        if resolve_sock then
+            poller:add(resolve_sock, EVENT_READ, RESOLVE_OBJ)
+        end
+    end
+    return setmetatable(self, mt)
+end
+
+
+function mt:add(sock)
+    local index = self.v_index
+    if index[sock] then
+        return
+    end
+
+    local list = self.v_list
+    list[#list+1] = sock
+    index[sock] = #list
+
+    local poller = self.v_poller
+    if poller then
+        sock:attach_poller(poller)
+    end
+end
+
+
+function mt:remove(sock)
+    local index = self.v_index
+    local i = index[sock]
+    if not i then
+        return
+    end
+
+    local list = self.v_list
+    local n = #list
+    local last = list[n]
+    list[i] = last
+    index[last] = i
+    list[n] = nil
+    index[sock] = nil
+
+    if self.v_poller then
+        sock:detach_poller()
+    end
+end
+
+
+function mt:count()
+    return #self.v_list
+end
+
+
+local function dispatch(self, sock, events)
+    local success, err, status = sock:update(events)
+    self.v_updates = self.v_updates + 1
+    if not success then
+        self.v_errors = self.v_errors + 1
+    end
+
+    local handle = self.v_handle
+    if handle then
+        handle(sock, success, err, status)
+    end
+end
+
+
+--[[
+timeout: 可选参数, poller等待的毫秒数, 默认为0不等待
+handle里可以remove连接, 已移除的连接不会再被更新
+]]
+function mt:update(timeout)
+    local poller = self.v_poller
+    if not poller then
+        local list = self.v_list
+        local n = #list
+        for i=n, 1, -1 do
+            local sock = list[i]
+            if sock then
+                dispatch(self, sock)
+            end
+        end
+        self.v_last_ready = n
+        return n
+    end
+
+    local ready = self.v_ready
+    local ready_events = self.v_ready_events
+    local index = self.v_index
+    local failed = self.v_failed
+    if failed[1] then
+        timeout = 0
+    else
+        -- 并行连接的下一个地址到期时要及时发起, 不能等满timeout
+        local wait = conn.next_attempt_wait()
+        if wait and timeout and (timeout < 0 or timeout > wait) then
+            timeout = wait
+        end
+    end
+    local n = poller:wait(ready, ready_events, timeout)
+    self.v_waits = self.v_waits + 1
+    conn.update_connecting()
+
+    for i=1, n do
+        local sock = ready[i]
+        ready[i] = nil
+        if sock == RESOLVE_OBJ then
+            -- 解析成功的连接已经注册了fd, 等连接完成时再更新;
+            -- 失败的没有fd, 它所在group的poller不会返回它, 交给那个group报告错误
+            local resolved = self.v_resolved
+            local count = conn.update_resolve(resolved)
+            for j=1, count do
+                local c = resolved[j]
+                resolved[j] = nil
+                local owner = c.v_poller and groups[c.v_poller]
+                if owner and not c.v_fd then
+                    local owner_failed = owner.v_failed
+                    owner_failed[#owner_failed+1] = c.v_poll_obj
+                end
+            end
+        elseif index[sock] then
+            dispatch(self, sock, ready_events[i])
+        end
+    end
+
+    for i=1, #failed do
+        local obj = failed[i]
+        failed[i] = nil
+        if index[obj] then
+            dispatch(self, obj)
+        end
+    end
+
+    self.v_last_ready = n
+    return n
+end
+
+
+--[[
+返回汇总统计:
+    count: 连接数
+    waits: poller:wait次数
+    updates: 累计update的连接次数
+    errors: update返回失败的次数
+    last_ready: 最近一次update的连接数
+    reads, budget_hit: 所有连接read_budget_stat的累加
+]]
+function mt:stat()
+    local reads, budget_hit = 0, 0
+    local list = self.v_list
+    for i=1, #list do
+        local st = list[i]:read_budget_stat()
+        reads = reads + st.reads
+        budget_hit = budget_hit + st.budget_hit
+    end
+
+    return {
+        count = #list,
+        waits = self.v_waits,
+        updates = self.v_updates,
+        errors = self.v_errors,
+        last_ready = self.v_last_ready,
+        reads = reads,
+        budget_hit = budget_hit,
+    }
+end
+
+
+-- 汇总所有连接的stat(), 字段见conn.stat/sconn.stat
+function mt:conn_stat()
+    local total = {}
+    local list = self.v_list
+    for i=1, #list do
+        stats.merge(total, list[i]:stat())
+    end
+    return total
+end
+
+
+-- 移除并返回所有连接, 不关闭连接
+function mt:clear()
+    local list = self.v_list
+    local ret = {}
+    for i=#list, 1, -1 do
+        local sock = list[i]
+        ret[#ret+1] = sock
+        self:remove(sock)
+    end
+    return ret
+end
+
+
+return {
+    new = new,
+}
@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+
+#define BUFFER_MIN_CAP (4096)
+
+#define MASK(b, i) ((i) & ((b)->cap - 1))
+
+void
+buffer_init(struct buffer *b) {
+  b->data = NULL;
+  b->cap = 0;
+  b->head = 0;
+  b->size = 0;
+}
+
+void
+buffer_free(struct buffer *b) {
+  free(b->data);
+  buffer_init(b);
+}
+
+void
+buffer_clear(struct buffer *b) {
+  b->head = 0;
+  b->size = 0;
+}
+
+int
+buffer_reserve(struct buffer *b, size_t n) {
+  size_t need = b->size + n;
+  size_t cap = b->cap;
+  char *data;
+
+  if (need <= cap) {
+    return 0;
+  }
+  if (need < b->size) {
+    return -1;  /* overflow */
+  }
+
+  if (cap == 0) {
+    cap = BUFFER_MIN_CAP;
+  }
+  while (cap < need) {
+    cap *= 2;
+  }
+
+  data = (char *)realloc(b->data, cap);
+  if (data == NULL) {
+    return -1;
+  }
+
+  /* unwrap: move the part at the front behind the old capacity */
+  if (b->head + b->size > b->cap) {
+    size_t wrapped = b->head + b->size - b->cap;
+    memcpy(data + b->cap, data, wrapped);
+  }
+  b->data = data;
+  b->cap = cap;
+  return 0;
+}
+
+int
+buffer_push(struct buffer *b, const void *data, size_t sz) {
+  char *seg[2];
+  size_t len[2];
+  size_t n;
+
+  if (sz == 0) {
+    return 0;
+  }
+  if (buffer_reserve(b, sz) != 0) {
+    return -1;
+  }
+  buffer_writable(b, seg, len);
+  n = sz < len[0] ? sz : len[0];
+  memcpy(seg[0], data, n);
+  if (n < sz) {
+    memcpy(seg[1], (const char *)data + n, sz - n);
+  }
+  b->size += sz;
+  return 0;
+}
+
+size_t
+buffer_peek(const struct buffer *b, size_t offset, void *out, size_t n) {
+  size_t start, first;
+
+  if (offset >= b->size) {
+    return 0;
+  }
+  if (n > b->size - offset) {
+    n = b->size - offset;
+  }
+
+  start = MASK(b, b->head + offset);
+  first = b->cap - start;
+  if (first >= n) {
+    memcpy(out, b->data + start, n);
+  } else {
+    memcpy(out, b->data + start, first);
+    memcpy((char *)out + first, b->data, n - first);
+  }
+  return n;
+}
+
+int
+buffer_copy(struct buffer *dst, const struct buffer *src, size_t offset, size_t n) {
+  char *seg[2];
+  size_t len[2];
+  size_t first;
+
+  if (offset > src->size || n > src->size - offset) {
+    return -1;
+  }
+  if (n == 0) {
+    return 0;
+  }
+  if (buffer_reserve(dst, n) != 0) {
+    return -1;
+  }
+  buffer_writable(dst, seg, len);
+  first = n < len[0] ? n : len[0];
+  buffer_peek(src, offset, seg[0], first);
+  if (first < n) {
+    buffer_peek(src, offset + first, seg[1], n - first);
+  }
+  dst->size += n;
+  return 0;
+}
+
+void
+buffer_drop(struct buffer *b, size_t n) {
+  if (n >= b->size) {
+    buffer_clear(b);
+    return;
+  }
+  b->head = MASK(b, b->head + n);
+  b->size -= n;
+}
+
+int
+buffer_readable(const struct buffer *b, const char *seg[2], size_t len[2]) {
+  size_t first;
+
+  seg[0] = seg[1] = NULL;
+  len[0] = len[1] = 0;
+  if (b->size == 0) {
+    return 0;
+  }
+  first = b->cap - b->head;
+  seg[0] = b->data + b->head;
+  if (first >= b->size) {
+    len[0] = b->size;
+    return 1;
+  }
+  len[0] = first;
+  seg[1] = b->data;
+  len[1] = b->size - first;
+  return 2;
+}
+
+int
+buffer_writable(const struct buffer *b, char *seg[2], size_t len[2]) {
+  size_t tail, room;
+
+  seg[0] = seg[1] = NULL;
+  len[0] = len[1] = 0;
+  room = b->cap - b->size;
+  if (room == 0) {
+    return 0;
+  }
+  tail = MASK(b, b->head + b->size);
+  seg[0] = b->data + tail;
+  if (tail < b->head || b->cap - tail >= room) {
+    len[0] = room;
+    return 1;
+  }
+  len[0] = b->cap - tail;
+  seg[1] = b->data;
+  len[1] = room - len[0];
+  return 2;
+}
+
+void
+buffer_commit(struct buffer *b, size_t n) {
+  b->size += n;
+}
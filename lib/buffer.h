@@ -0,0 +1,54 @@
+#ifndef _BUFFER_H_
+#define _BUFFER_H_
+
+#include <stddef.h>
+
+/*
+ * growable byte ring buffer, capacity is always power of two.
+ * readable bytes are [head, head+size) wrapped by capacity.
+ */
+struct buffer {
+  char   *data;
+  size_t  cap;
+  size_t  head;
+  size_t  size;
+};
+
+void buffer_init(struct buffer *b);
+void buffer_free(struct buffer *b);
+void buffer_clear(struct buffer *b);
+
+/* make room for at least n more bytes, return 0 on success */
+int buffer_reserve(struct buffer *b, size_t n);
+
+/* append sz bytes, return 0 on success */
+int buffer_push(struct buffer *b, const void *data, size_t sz);
+
+/* copy n bytes starting at offset into out, return copied bytes */
+size_t buffer_peek(const struct buffer *b, size_t offset, void *out, size_t n);
+
+/*
+ * append n bytes of src starting at offset to dst, return 0 on success.
+ * src and dst must be different buffers.
+ */
+int buffer_copy(struct buffer *dst, const struct buffer *src, size_t offset, size_t n);
+
+/* discard n bytes from head */
+void buffer_drop(struct buffer *b, size_t n);
+
+/*
+ * readable data as at most two contiguous segments, return segment count.
+ * seg[i] is a pointer into the buffer, valid until next modification.
+ * unused segments are set to NULL with length 0.
+ */
+int buffer_readable(const struct buffer *b, const char *seg[2], size_t len[2]);
+
+/*
+ * writable space after the tail as at most two contiguous segments,
+ * call buffer_commit after filling them. return segment count, unused
+ * segments are set to NULL with length 0.
+ */
+int buffer_writable(const struct buffer *b, char *seg[2], size_t len[2]);
+void buffer_commit(struct buffer *b, size_t n);
+
+#endif
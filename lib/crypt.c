@@ -0,0 +1,774 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "crypt.h"
+
+#ifdef _MSC_VER
+#define random rand
+#endif // _MSC_VER
+
+void
+crypt_randomkey(uint8_t key[8]) {
+  int i;
+  uint8_t x = 0;
+  for (i=0;i<8;i++) {
+    key[i] = random() & 0xff;
+    x ^= key[i];
+  }
+  if (x==0) {
+    key[0] |= 1;  // avoid 0
+  }
+}
+
+void
+crypt_hashkey(const char * str, size_t sz, uint8_t key[8]) {
+  uint32_t djb_hash = 5381L;
+  uint32_t js_hash = 1315423911L;
+
+  size_t i;
+  for (i=0;i<sz;i++) {
+    uint8_t c = (uint8_t)str[i];
+    djb_hash += (djb_hash << 5) + c;
+    js_hash ^= ((js_hash << 5) + c + (js_hash >> 2));
+  }
+
+  key[0] = djb_hash & 0xff;
+  key[1] = (djb_hash >> 8) & 0xff;
+  key[2] = (djb_hash >> 16) & 0xff;
+  key[3] = (djb_hash >> 24) & 0xff;
+
+  key[4] = js_hash & 0xff;
+  key[5] = (js_hash >> 8) & 0xff;
+  key[6] = (js_hash >> 16) & 0xff;
+  key[7] = (js_hash >> 24) & 0xff;
+}
+
+// Constants are the integer part of the sines of integers (in radians) * 2^32.
+static const uint32_t k[64] = {
+0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee ,
+0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501 ,
+0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be ,
+0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821 ,
+0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa ,
+0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8 ,
+0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed ,
+0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a ,
+0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c ,
+0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70 ,
+0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05 ,
+0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665 ,
+0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039 ,
+0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1 ,
+0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1 ,
+0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391 };
+ 
+// r specifies the per-round shift amounts
+static const uint32_t r[] = {7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+            5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+            4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+            6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
+ 
+// leftrotate function definition
+#define LEFTROTATE(x, c) (((x) << (c)) | ((x) >> (32 - (c))))
+
+static void
+digest_md5(uint32_t w[16], uint32_t result[4]) {
+  uint32_t a, b, c, d, f, g, temp;
+  int i;
+ 
+  a = 0x67452301u;
+  b = 0xefcdab89u;
+  c = 0x98badcfeu;
+  d = 0x10325476u;
+
+  for(i = 0; i<64; i++) {
+    if (i < 16) {
+      f = (b & c) | ((~b) & d);
+      g = i;
+    } else if (i < 32) {
+      f = (d & b) | ((~d) & c);
+      g = (5*i + 1) % 16;
+    } else if (i < 48) {
+      f = b ^ c ^ d;
+      g = (3*i + 5) % 16; 
+    } else {
+      f = c ^ (b | (~d));
+      g = (7*i) % 16;
+    }
+
+    temp = d;
+    d = c;
+    c = b;
+    b = b + LEFTROTATE((a + f + k[i] + w[g]), r[i]);
+    a = temp;
+  }
+
+  result[0] = a;
+  result[1] = b;
+  result[2] = c;
+  result[3] = d;
+}
+
+// hmac64 use md5 algorithm without padding, and the result is (c^d .. a^b)
+void
+crypt_hmac64(uint32_t x[2], uint32_t y[2], uint32_t result[2]) {
+  uint32_t w[16];
+  uint32_t r[4];
+  int i;
+  for (i=0;i<16;i+=4) {
+    w[i] = x[1];
+    w[i+1] = x[0];
+    w[i+2] = y[1];
+    w[i+3] = y[0];
+  }
+
+  digest_md5(w,r);
+
+  result[0] = r[2]^r[3];
+  result[1] = r[0]^r[1];
+}
+
+void
+crypt_hmac64_md5(uint32_t x[2], uint32_t y[2], uint32_t result[2]) {
+  uint32_t w[16];
+  uint32_t r[4];
+  int i;
+  for (i=0;i<12;i+=4) {
+    w[i] = x[0];
+    w[i+1] = x[1];
+    w[i+2] = y[0];
+    w[i+3] = y[1];
+  }
+
+  w[12] = 0x80;
+  w[13] = 0;
+  w[14] = 384;
+  w[15] = 0;
+
+  digest_md5(w,r);
+
+  result[0] = (r[0] + 0x67452301u) ^ (r[2] + 0x98badcfeu);
+  result[1] = (r[1] + 0xefcdab89u) ^ (r[3] + 0x10325476u);
+}
+
+// powmodp64 for DH-key exchange
+
+// The biggest 64bit prime
+#define P 0xffffffffffffffc5ull
+
+// the portable loop, doubling a and adding it in for every bit of b.
+// always built so the 128bit path can be checked and timed against it
+static inline uint64_t
+mul_mod_p_serial(uint64_t a, uint64_t b) {
+  uint64_t m = 0;
+  while(b) {
+    if(b&1) {
+      uint64_t t = P-a;
+      if ( m >= t) {
+        m -= t;
+      } else {
+        m += a;
+      }
+    }
+    if (a >= P - a) {
+      a = a * 2 - P;
+    } else {
+      a = a * 2;
+    }
+    b>>=1;
+  }
+  return m;
+}
+
+#ifdef __SIZEOF_INT128__
+
+#define CRYPT_HAVE_INT128
+
+// 2^64 = P + 59, so the high word folds back into the low word as hi*59.
+// the product is < 2^128, after the folds it is < 2^70, < 2^64 + 3776, < 2^64
+static inline uint64_t
+mul_mod_p_int128(uint64_t a, uint64_t b) {
+  unsigned __int128 t = (unsigned __int128)a * b;
+  t = (t & 0xffffffffffffffffull) + (t >> 64) * 59;
+  t = (t & 0xffffffffffffffffull) + (t >> 64) * 59;
+  t = (t & 0xffffffffffffffffull) + (t >> 64) * 59;
+  uint64_t m = (uint64_t)t;
+  if (m >= P) {
+    m -= P;
+  }
+  return m;
+}
+
+#endif
+
+// mul is a constant at every call, so each path gets its own inlined loop
+static inline uint64_t
+pow_mod_p(uint64_t a, uint64_t b, uint64_t (*mul)(uint64_t, uint64_t)) {
+  uint64_t r = 1;
+  while (b) {
+    if (b & 1) {
+      r = mul(r, a);
+    }
+    b >>= 1;
+    if (b) {
+      a = mul(a, a);
+    }
+  }
+  return r;
+}
+
+#ifdef CRYPT_HAVE_INT128
+static int dh_mul = CRYPT_DH_MUL_INT128;
+#else
+static int dh_mul = CRYPT_DH_MUL_SERIAL;
+#endif
+
+int
+crypt_dh_mul(void) {
+  return dh_mul;
+}
+
+int
+crypt_dh_mul_set(int mul) {
+#ifdef CRYPT_HAVE_INT128
+  dh_mul = mul;
+#else
+  (void)mul;
+#endif
+  return dh_mul;
+}
+
+// calc a^b % p
+uint64_t
+crypt_powmodp(uint64_t a, uint64_t b) {
+  if (a > P)
+    a%=P;
+#ifdef CRYPT_HAVE_INT128
+  if (dh_mul == CRYPT_DH_MUL_INT128) {
+    return pow_mod_p(a, b, mul_mod_p_int128);
+  }
+#endif
+  return pow_mod_p(a, b, mul_mod_p_serial);
+}
+
+// simd
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CRYPT_X86
+#include <immintrin.h>
+#define TARGET_SSE __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+static int simd_detected = -1;
+static int simd_level = -1;
+
+static int
+simd_detect(void) {
+#ifdef CRYPT_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return CRYPT_SIMD_AVX2;
+  if (__builtin_cpu_supports("ssse3"))
+    return CRYPT_SIMD_SSE;
+#endif
+  return CRYPT_SIMD_SCALAR;
+}
+
+int
+crypt_simd(void) {
+  if (simd_level < 0) {
+    simd_detected = simd_detect();
+    simd_level = simd_detected;
+  }
+  return simd_level;
+}
+
+int
+crypt_simd_set(int level) {
+  crypt_simd();
+  if (level > simd_detected)
+    level = simd_detected;
+  if (level < CRYPT_SIMD_SCALAR)
+    level = CRYPT_SIMD_SCALAR;
+  simd_level = level;
+  return level;
+}
+
+// base64
+
+static const char b64_encoding[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static size_t
+b64encode_scalar(const uint8_t *text, size_t sz, char *buffer) {
+  const char *encoding = b64_encoding;
+  size_t i, j;
+  j=0;
+  for (i=0;i+2<sz;i+=3) {
+    uint32_t v = text[i] << 16 | text[i+1] << 8 | text[i+2];
+    buffer[j] = encoding[v >> 18];
+    buffer[j+1] = encoding[(v >> 12) & 0x3f];
+    buffer[j+2] = encoding[(v >> 6) & 0x3f];
+    buffer[j+3] = encoding[(v) & 0x3f];
+    j+=4;
+  }
+  int padding = sz-i;
+  uint32_t v;
+  switch(padding) {
+  case 1 :
+    v = text[i];
+    buffer[j] = encoding[v >> 2];
+    buffer[j+1] = encoding[(v & 3) << 4];
+    buffer[j+2] = '=';
+    buffer[j+3] = '=';
+    j+=4;
+    break;
+  case 2 :
+    v = text[i] << 8 | text[i+1];
+    buffer[j] = encoding[v >> 10];
+    buffer[j+1] = encoding[(v >> 4) & 0x3f];
+    buffer[j+2] = encoding[(v & 0xf) << 2];
+    buffer[j+3] = '=';
+    j+=4;
+    break;
+  }
+  return j;
+}
+
+static inline int
+b64index(uint8_t c) {
+  static const int decoding[] = {62,-1,-1,-1,63,52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-2,-1,-1,-1,0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,-1,-1,-1,-1,-1,-1,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,41,42,43,44,45,46,47,48,49,50,51};
+  int decoding_size = sizeof(decoding)/sizeof(decoding[0]);
+  if (c<43) {
+    return -1;
+  }
+  c -= 43;
+  if (c>=decoding_size)
+    return -1;
+  return decoding[c];
+}
+
+/*
+ * The vector paths follow Wojciech Mula's base64 with pshufb:
+ * encode splits each 3 bytes into 4 indices with two multiplies and maps
+ * them to ascii by adding a per range offset, decode classifies every
+ * char by its two nibbles, so one shuffle pair validates the whole
+ * block. A block containing anything but the 64 alphabet chars ('=' and
+ * whitespace included) stops the vector loop and is left to the scalar
+ * code. Each function returns the input bytes it consumed.
+ */
+#ifdef CRYPT_X86
+
+TARGET_SSE static inline __m128i
+b64enc_block_sse(__m128i in) {
+  // [b a c b] in every 32bit lane for the 3 bytes a b c
+  in = _mm_shuffle_epi8(in, _mm_setr_epi8(1,0,2,1, 4,3,5,4, 7,6,8,7, 10,9,11,10));
+  __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+  __m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+  __m128i indices = _mm_or_si128(t0, t1);
+  // 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12
+  __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+  __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+  range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+  const __m128i offset = _mm_setr_epi8('a'-26, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52,
+    '0'-52, '0'-52, '0'-52, '0'-52, '+'-62, '/'-63, 'A', 0, 0);
+  return _mm_add_epi8(indices, _mm_shuffle_epi8(offset, range));
+}
+
+TARGET_SSE static size_t
+b64encode_sse(const uint8_t *text, size_t sz, char *buffer) {
+  size_t i;
+  // load 16 bytes, use 12
+  for (i=0;i+16<=sz;i+=12) {
+    __m128i in = _mm_loadu_si128((const __m128i *)(text + i));
+    _mm_storeu_si128((__m128i *)(buffer + i/3*4), b64enc_block_sse(in));
+  }
+  return i;
+}
+
+TARGET_AVX2 static inline __m256i
+b64enc_block_avx2(__m256i in) {
+  in = _mm256_shuffle_epi8(in, _mm256_setr_epi8(1,0,2,1, 4,3,5,4, 7,6,8,7, 10,9,11,10,
+    1,0,2,1, 4,3,5,4, 7,6,8,7, 10,9,11,10));
+  __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+  __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+  __m256i indices = _mm256_or_si256(t0, t1);
+  __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+  __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+  range = _mm256_or_si256(range, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+  const __m256i offset = _mm256_broadcastsi128_si256(_mm_setr_epi8('a'-26, '0'-52, '0'-52, '0'-52,
+    '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '+'-62, '/'-63, 'A', 0, 0));
+  return _mm256_add_epi8(indices, _mm256_shuffle_epi8(offset, range));
+}
+
+TARGET_AVX2 static size_t
+b64encode_avx2(const uint8_t *text, size_t sz, char *buffer) {
+  size_t i;
+  // 12 bytes at the start of each 128bit lane
+  for (i=0;i+28<=sz;i+=24) {
+    __m128i lo = _mm_loadu_si128((const __m128i *)(text + i));
+    __m128i hi = _mm_loadu_si128((const __m128i *)(text + i + 12));
+    __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    _mm256_storeu_si256((__m256i *)(buffer + i/3*4), b64enc_block_avx2(in));
+  }
+  return i;
+}
+
+/*
+ * buffer is sized for the whole text, 3/4 of the input. the stores write
+ * 4 bytes past each decoded block (8 for avx2), so keep 24 (48) input
+ * bytes ahead to stay inside it.
+ */
+TARGET_SSE static size_t
+b64decode_sse(const uint8_t *text, size_t sz, uint8_t *buffer) {
+  const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+    0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  size_t i;
+  for (i=0;i+24<=sz;i+=16) {
+    __m128i in = _mm_loadu_si128((const __m128i *)(text + i));
+    __m128i hi = _mm_and_si128(_mm_srli_epi32(in, 4), nibble);
+    __m128i lo = _mm_and_si128(in, nibble);
+    __m128i bad = _mm_and_si128(_mm_shuffle_epi8(lut_lo, lo), _mm_shuffle_epi8(lut_hi, hi));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(bad, _mm_setzero_si128())) != 0xffff)
+      break;
+    __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(in, _mm_set1_epi8('/')), hi));
+    __m128i v = _mm_add_epi8(in, roll);
+    // pack 4 6bit values into 3 bytes per 32bit lane
+    v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+    v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+    v = _mm_shuffle_epi8(v, _mm_setr_epi8(2,1,0, 6,5,4, 10,9,8, 14,13,12, -1,-1,-1,-1));
+    _mm_storeu_si128((__m128i *)(buffer + i/4*3), v);
+  }
+  return i;
+}
+
+TARGET_AVX2 static size_t
+b64decode_avx2(const uint8_t *text, size_t sz, uint8_t *buffer) {
+  const __m256i lut_lo = _mm256_broadcastsi128_si256(_mm_setr_epi8(0x15, 0x11, 0x11, 0x11,
+    0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a));
+  const __m256i lut_hi = _mm256_broadcastsi128_si256(_mm_setr_epi8(0x10, 0x10, 0x01, 0x02,
+    0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10));
+  const __m256i lut_roll = _mm256_broadcastsi128_si256(_mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+    0, 0, 0, 0, 0, 0, 0, 0));
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  const __m256i pack = _mm256_broadcastsi128_si256(_mm_setr_epi8(2,1,0, 6,5,4, 10,9,8, 14,13,12,
+    -1,-1,-1,-1));
+  size_t i;
+  for (i=0;i+48<=sz;i+=32) {
+    __m256i in = _mm256_loadu_si256((const __m256i *)(text + i));
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi32(in, 4), nibble);
+    __m256i lo = _mm256_and_si256(in, nibble);
+    __m256i bad = _mm256_and_si256(_mm256_shuffle_epi8(lut_lo, lo), _mm256_shuffle_epi8(lut_hi, hi));
+    if (!_mm256_testz_si256(bad, bad))
+      break;
+    __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('/')), hi));
+    __m256i v = _mm256_add_epi8(in, roll);
+    v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+    v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+    v = _mm256_shuffle_epi8(v, pack);
+    // 12 bytes at the start of each lane -> 24 contiguous bytes
+    v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+    _mm256_storeu_si256((__m256i *)(buffer + i/4*3), v);
+  }
+  return i;
+}
+
+#endif // CRYPT_X86
+
+size_t
+crypt_b64encode(const uint8_t *text, size_t sz, char *buffer) {
+  size_t i = 0;
+#ifdef CRYPT_X86
+  int level = crypt_simd();
+  if (level >= CRYPT_SIMD_AVX2)
+    i = b64encode_avx2(text, sz, buffer);
+  if (level >= CRYPT_SIMD_SSE)
+    i += b64encode_sse(text + i, sz - i, buffer + i/3*4);
+#endif
+  return i/3*4 + b64encode_scalar(text + i, sz - i, buffer + i/3*4);
+}
+
+int
+crypt_b64decode(const uint8_t *text, size_t sz, uint8_t *buffer, int strict) {
+  size_t i;
+  int j;
+  int output = 0;
+#ifdef CRYPT_X86
+  int level = crypt_simd();
+#endif
+  for (i=0;i<sz;) {
+#ifdef CRYPT_X86
+    // at a group boundary, try the vector path first
+    if (level >= CRYPT_SIMD_SSE && sz - i >= 24) {
+      size_t n = 0;
+      if (level >= CRYPT_SIMD_AVX2)
+        n = b64decode_avx2(text + i, sz - i, buffer + output);
+      n += b64decode_sse(text + i + n, sz - i - n, buffer + output + n/4*3);
+      i += n;
+      output += n/4*3;
+    }
+#endif
+    int padding = 0;
+    int c[4];
+    for (j=0;j<4;) {
+      if (i>=sz) {
+        return -1;
+      }
+      c[j] = b64index(text[i]);
+      if (c[j] == -1) {
+        if (strict) {
+          return -1;
+        }
+        ++i;
+        continue;
+      }
+      if (c[j] == -2) {
+        ++padding;
+      }
+      ++i;
+      ++j;
+    }
+    uint32_t v;
+    switch (padding) {
+    case 0:
+      v = (unsigned)c[0] << 18 | c[1] << 12 | c[2] << 6 | c[3];
+      buffer[output] = v >> 16;
+      buffer[output+1] = (v >> 8) & 0xff;
+      buffer[output+2] = v & 0xff;
+      output += 3;
+      break;
+    case 1:
+      if (c[3] != -2 || (c[2] & 3)!=0) {
+        return -1;
+      }
+      v = (unsigned)c[0] << 10 | c[1] << 4 | c[2] >> 2 ;
+      buffer[output] = v >> 8;
+      buffer[output+1] = v & 0xff;
+      output += 2;
+      break;
+    case 2:
+      if (c[3] != -2 || c[2] != -2 || (c[1] & 0xf) !=0)  {
+        return -1;
+      }
+      v = (unsigned)c[0] << 2 | c[1] >> 4;
+      buffer[output] = v;
+      ++ output;
+      break;
+    default:
+      return -1;
+    }
+    // padding only ends the text in strict mode
+    if (strict && padding && i < sz) {
+      return -1;
+    }
+  }
+  return output;
+}
+
+// hex
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// 0..15 for [0-9a-f], bit 8 set for anything else, uppercase included
+static inline unsigned
+hex_nibble(uint8_t c) {
+  unsigned digit = (uint8_t)(c - '0') < 10;
+  unsigned alpha = (uint8_t)(c - 'a') < 6;
+  return ((unsigned)(c - '0') & -digit) | ((unsigned)(c - 'a' + 10) & -alpha) | ((digit | alpha) ^ 1) << 8;
+}
+
+#ifdef CRYPT_X86
+
+TARGET_SSE static size_t
+tohex_sse(const uint8_t *text, size_t sz, char *buffer) {
+  const __m128i digits = _mm_loadu_si128((const __m128i *)hex_digits);
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  size_t i;
+  for (i=0;i+16<=sz;i+=16) {
+    __m128i in = _mm_loadu_si128((const __m128i *)(text + i));
+    __m128i hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(in, 4), nibble));
+    __m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(in, nibble));
+    _mm_storeu_si128((__m128i *)(buffer + i*2), _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128((__m128i *)(buffer + i*2 + 16), _mm_unpackhi_epi8(hi, lo));
+  }
+  return i;
+}
+
+TARGET_AVX2 static size_t
+tohex_avx2(const uint8_t *text, size_t sz, char *buffer) {
+  const __m256i digits = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)hex_digits));
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  size_t i;
+  for (i=0;i+32<=sz;i+=32) {
+    __m256i in = _mm256_loadu_si256((const __m256i *)(text + i));
+    __m256i hi = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble));
+    __m256i lo = _mm256_shuffle_epi8(digits, _mm256_and_si256(in, nibble));
+    // unpack works inside each lane, swap the middle halves back
+    __m256i a = _mm256_unpacklo_epi8(hi, lo);
+    __m256i b = _mm256_unpackhi_epi8(hi, lo);
+    _mm256_storeu_si256((__m256i *)(buffer + i*2), _mm256_permute2x128_si256(a, b, 0x20));
+    _mm256_storeu_si256((__m256i *)(buffer + i*2 + 32), _mm256_permute2x128_si256(a, b, 0x31));
+  }
+  return i;
+}
+
+// chars to nibbles, clears the bytes of valid that aren't [0-9a-f]
+TARGET_SSE static inline __m128i
+hex_nibbles_sse(__m128i c, __m128i *valid) {
+  __m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+  __m128i a = _mm_sub_epi8(c, _mm_set1_epi8('a'));
+  __m128i is_d = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+  __m128i is_a = _mm_cmpeq_epi8(_mm_min_epu8(a, _mm_set1_epi8(5)), a);
+  *valid = _mm_and_si128(*valid, _mm_or_si128(is_d, is_a));
+  return _mm_or_si128(_mm_and_si128(is_d, d), _mm_and_si128(is_a, _mm_add_epi8(a, _mm_set1_epi8(10))));
+}
+
+TARGET_SSE static size_t
+fromhex_sse(const char *text, size_t sz, uint8_t *buffer, unsigned *bad) {
+  // hi*16 + lo for each pair of nibbles
+  const __m128i weight = _mm_set1_epi16(0x0110);
+  __m128i valid = _mm_set1_epi8(-1);
+  size_t i;
+  for (i=0;i+32<=sz;i+=32) {
+    __m128i n0 = hex_nibbles_sse(_mm_loadu_si128((const __m128i *)(text + i)), &valid);
+    __m128i n1 = hex_nibbles_sse(_mm_loadu_si128((const __m128i *)(text + i + 16)), &valid);
+    __m128i v = _mm_packus_epi16(_mm_maddubs_epi16(n0, weight), _mm_maddubs_epi16(n1, weight));
+    _mm_storeu_si128((__m128i *)(buffer + i/2), v);
+  }
+  *bad |= _mm_movemask_epi8(valid) != 0xffff;
+  return i;
+}
+
+TARGET_AVX2 static inline __m256i
+hex_nibbles_avx2(__m256i c, __m256i *valid) {
+  __m256i d = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+  __m256i a = _mm256_sub_epi8(c, _mm256_set1_epi8('a'));
+  __m256i is_d = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+  __m256i is_a = _mm256_cmpeq_epi8(_mm256_min_epu8(a, _mm256_set1_epi8(5)), a);
+  *valid = _mm256_and_si256(*valid, _mm256_or_si256(is_d, is_a));
+  return _mm256_or_si256(_mm256_and_si256(is_d, d), _mm256_and_si256(is_a, _mm256_add_epi8(a, _mm256_set1_epi8(10))));
+}
+
+TARGET_AVX2 static size_t
+fromhex_avx2(const char *text, size_t sz, uint8_t *buffer, unsigned *bad) {
+  const __m256i weight = _mm256_set1_epi16(0x0110);
+  __m256i valid = _mm256_set1_epi8(-1);
+  size_t i;
+  for (i=0;i+64<=sz;i+=64) {
+    __m256i n0 = hex_nibbles_avx2(_mm256_loadu_si256((const __m256i *)(text + i)), &valid);
+    __m256i n1 = hex_nibbles_avx2(_mm256_loadu_si256((const __m256i *)(text + i + 32)), &valid);
+    __m256i v = _mm256_packus_epi16(_mm256_maddubs_epi16(n0, weight), _mm256_maddubs_epi16(n1, weight));
+    // packus works inside each lane
+    v = _mm256_permute4x64_epi64(v, 0xd8);
+    _mm256_storeu_si256((__m256i *)(buffer + i/2), v);
+  }
+  *bad |= (uint32_t)_mm256_movemask_epi8(valid) != 0xffffffffu;
+  return i;
+}
+
+#endif // CRYPT_X86
+
+void
+crypt_tohex(const uint8_t *text, size_t sz, char *buffer) {
+  size_t i = 0;
+#ifdef CRYPT_X86
+  int level = crypt_simd();
+  if (level >= CRYPT_SIMD_AVX2)
+    i = tohex_avx2(text, sz, buffer);
+  if (level >= CRYPT_SIMD_SSE)
+    i += tohex_sse(text + i, sz - i, buffer + i*2);
+#endif
+  for (;i<sz;i++) {
+    buffer[i*2] = hex_digits[text[i] >> 4];
+    buffer[i*2+1] = hex_digits[text[i] & 0xf];
+  }
+}
+
+int
+crypt_fromhex(const char *text, size_t sz, uint8_t *buffer) {
+  unsigned bad = 0;
+  size_t i = 0;
+#ifdef CRYPT_X86
+  int level = crypt_simd();
+  if (level >= CRYPT_SIMD_AVX2)
+    i = fromhex_avx2(text, sz, buffer, &bad);
+  if (level >= CRYPT_SIMD_SSE)
+    i += fromhex_sse(text + i, sz - i, buffer + i/2, &bad);
+#endif
+  for (;i+1<sz;i+=2) {
+    unsigned hi = hex_nibble(text[i]);
+    unsigned lo = hex_nibble(text[i+1]);
+    bad |= (hi | lo) >> 8;
+    buffer[i/2] = (uint8_t)(hi << 4 | lo);
+  }
+  return bad ? -1 : 0;
+}
+
+// xor
+
+#define XOR_EXPAND 512
+
+#ifdef CRYPT_X86
+
+TARGET_SSE static size_t
+xor_sse(const uint8_t *a, const uint8_t *b, size_t sz, uint8_t *out) {
+  size_t i;
+  for (i=0;i+16<=sz;i+=16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+    __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+    _mm_storeu_si128((__m128i *)(out + i), _mm_xor_si128(x, y));
+  }
+  return i;
+}
+
+TARGET_AVX2 static size_t
+xor_avx2(const uint8_t *a, const uint8_t *b, size_t sz, uint8_t *out) {
+  size_t i;
+  for (i=0;i+32<=sz;i+=32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+    __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+    _mm256_storeu_si256((__m256i *)(out + i), _mm256_xor_si256(x, y));
+  }
+  return i;
+}
+
+#endif // CRYPT_X86
+
+void
+crypt_xor(const uint8_t *text, size_t sz, const uint8_t *key, size_t keysz, uint8_t *buffer) {
+  uint8_t expand[XOR_EXPAND];
+  size_t i, j, n;
+  if (keysz < sz && keysz <= XOR_EXPAND/2) {
+    // repeat a short key, so each run below is long enough for the vector loop
+    n = XOR_EXPAND / keysz * keysz;
+    if (n > sz)
+      n = (sz + keysz - 1) / keysz * keysz;
+    memcpy(expand, key, keysz);
+    for (j=keysz;j<n;j*=2) {
+      memcpy(expand + j, expand, j*2 <= n ? j : n - j);
+    }
+    key = expand;
+    keysz = n;
+  }
+#ifdef CRYPT_X86
+  int level = crypt_simd();
+#endif
+  // every run starts at the beginning of the key, no modulo per byte
+  for (i=0;i<sz;i+=n) {
+    n = sz - i < keysz ? sz - i : keysz;
+    j = 0;
+#ifdef CRYPT_X86
+    if (level >= CRYPT_SIMD_AVX2)
+      j = xor_avx2(text + i, key, n, buffer + i);
+    if (level >= CRYPT_SIMD_SSE)
+      j += xor_sse(text + i + j, key + j, n - j, buffer + i + j);
+#endif
+    for (;j<n;j++) {
+      buffer[i+j] = text[i+j] ^ key[j];
+    }
+  }
+}
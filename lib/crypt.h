@@ -0,0 +1,70 @@
+#ifndef _CRYPT_H_
+#define _CRYPT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * crypto primitives used by the goscon protocol, shared by crypt.so
+ * (lcrypt.c) and the native test server. 64bit values are passed as two
+ * little endian 32bit words, the same layout as the 8 byte lua strings.
+ */
+
+#define CRYPT_DH_G 5
+
+/* 8 random bytes, never all zero when xored together */
+void crypt_randomkey(uint8_t key[8]);
+
+/* djb/js hash of a string into an 8 byte key */
+void crypt_hashkey(const char *str, size_t sz, uint8_t key[8]);
+
+void crypt_hmac64(uint32_t x[2], uint32_t y[2], uint32_t result[2]);
+void crypt_hmac64_md5(uint32_t x[2], uint32_t y[2], uint32_t result[2]);
+
+/* a^b mod (2^64 - 59) */
+uint64_t crypt_powmodp(uint64_t a, uint64_t b);
+
+/*
+ * crypt_powmodp multiplies with 128bit products when the compiler has
+ * them, else with the bit-serial loop. crypt_dh_mul_set picks the loop
+ * anyway, for tests and benchmarks, and returns the one in effect.
+ */
+#define CRYPT_DH_MUL_SERIAL 0
+#define CRYPT_DH_MUL_INT128 1
+int crypt_dh_mul(void);
+int crypt_dh_mul_set(int mul);
+
+/*
+ * base64, hex and xor use ssse3 or avx2 when the cpu has them, detected
+ * at the first call. crypt_simd_set lowers the level, for tests and
+ * benchmarks, and returns the level in effect.
+ */
+#define CRYPT_SIMD_SCALAR 0
+#define CRYPT_SIMD_SSE 1
+#define CRYPT_SIMD_AVX2 2
+int crypt_simd(void);
+int crypt_simd_set(int level);
+
+/* out needs CRYPT_B64_ENCODE_SIZE(sz) bytes, return encoded size */
+#define CRYPT_B64_ENCODE_SIZE(sz) (((sz) + 2) / 3 * 4)
+size_t crypt_b64encode(const uint8_t *text, size_t sz, char *out);
+
+/*
+ * out needs CRYPT_B64_DECODE_SIZE(sz) bytes. characters outside the
+ * alphabet are skipped, or rejected when strict is set, and strict text
+ * can only have padding at the end. return decoded size, or -1 for
+ * invalid text.
+ */
+#define CRYPT_B64_DECODE_SIZE(sz) (((sz) + 3) / 4 * 3)
+int crypt_b64decode(const uint8_t *text, size_t sz, uint8_t *out, int strict);
+
+/* lowercase hex, out needs sz*2 bytes */
+void crypt_tohex(const uint8_t *text, size_t sz, char *out);
+
+/* sz is even, out needs sz/2 bytes. return -1 if any char isn't [0-9a-f] */
+int crypt_fromhex(const char *text, size_t sz, uint8_t *out);
+
+/* out[i] = text[i] ^ key[i % keysz], keysz > 0 */
+void crypt_xor(const uint8_t *text, size_t sz, const uint8_t *key, size_t keysz, uint8_t *out);
+
+#endif
@@ -0,0 +1,517 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "buffer.h"
+#include "lbuffer.h"
+
+/*
+ * buffer.create([capacity]) --> ring buffer object with the same api
+ * as the old lua buffer_queue:
+ *   push/pop/look/pop_all/push_block/pop_block/pop_all_block/clear/get_head_data
+ */
+
+#define MAX_HEADER_LEN (8)
+
+static struct buffer *
+_getbuffer(lua_State *L, int index) {
+  return (struct buffer *)luaL_checkudata(L, index, BUFFER_METATABLE);
+}
+
+static int
+_check_endian(lua_State *L, int index) {
+  static const char *const opts[] = { "little", "big", NULL };
+  return luaL_checkoption(L, index, NULL, opts);
+}
+
+static int
+_check_header_len(lua_State *L, int index) {
+  lua_Integer header_len = luaL_checkinteger(L, index);
+  luaL_argcheck(L, header_len > 0 && header_len <= MAX_HEADER_LEN, index, "invalid header length");
+  return (int)header_len;
+}
+
+static void
+_check_push(lua_State *L, int err) {
+  if (err != 0) {
+    luaL_error(L, "buffer: out of memory");
+  }
+}
+
+/*
+ * push n bytes from offset as lua string, the buffer is unchanged.
+ * seg/len are the readable segments of b.
+ */
+static void
+_pushseg(lua_State *L, struct buffer *b, const char *seg[2], size_t len[2], size_t offset, size_t n) {
+  if (offset + n <= len[0]) {
+    lua_pushlstring(L, seg[0] + offset, n);
+  } else if (offset >= len[0]) {
+    lua_pushlstring(L, seg[1] + (offset - len[0]), n);
+  } else {
+    luaL_Buffer lb;
+    char *p = luaL_buffinitsize(L, &lb, n);
+    buffer_peek(b, offset, p, n);
+    luaL_pushresultsize(&lb, n);
+  }
+}
+
+static void
+_pushrange(lua_State *L, struct buffer *b, size_t offset, size_t n) {
+  const char *seg[2];
+  size_t len[2];
+  if (buffer_readable(b, seg, len) < 2) {
+    len[1] = 0;
+  }
+  _pushseg(L, b, seg, len, offset, n);
+}
+
+static size_t
+_read_header(const uint8_t *p, int header_len, int big) {
+  size_t len = 0;
+  int i;
+  switch (header_len) {
+  case 2:
+    return big ? ((size_t)p[0] << 8 | p[1]) : ((size_t)p[1] << 8 | p[0]);
+  case 4:
+    return big
+      ? ((size_t)p[0] << 24 | (size_t)p[1] << 16 | (size_t)p[2] << 8 | p[3])
+      : ((size_t)p[3] << 24 | (size_t)p[2] << 16 | (size_t)p[1] << 8 | p[0]);
+  }
+  if (big) {
+    for (i=0; i<header_len; i++) {
+      len = (len << 8) | p[i];
+    }
+  } else {
+    for (i=header_len-1; i>=0; i--) {
+      len = (len << 8) | p[i];
+    }
+  }
+  return len;
+}
+
+/* header at offset, read in place unless it straddles the wrap point */
+static size_t
+_decode_header(struct buffer *b, const char *seg[2], size_t len[2], size_t offset, int header_len, int big) {
+  uint8_t header[MAX_HEADER_LEN];
+  if (offset + header_len <= len[0]) {
+    return _read_header((const uint8_t *)seg[0] + offset, header_len, big);
+  } else if (offset >= len[0]) {
+    return _read_header((const uint8_t *)seg[1] + (offset - len[0]), header_len, big);
+  }
+  buffer_peek(b, offset, header, header_len);
+  return _read_header(header, header_len, big);
+}
+
+static void
+_encode_header(uint8_t header[MAX_HEADER_LEN], size_t len, int header_len, int big) {
+  int i;
+  for (i=0; i<header_len; i++) {
+    int pos = big ? header_len - i - 1 : i;
+    header[pos] = (uint8_t)(len & 0xff);
+    len >>= 8;
+  }
+}
+
+/*
+ * scan complete frames from the head in one pass, push each payload into
+ * the table at index out and drop them all at once.
+ * max <= 0 means no limit. return frame count.
+ */
+static int
+_pop_frames(lua_State *L, struct buffer *b, int out, int header_len, int big, int max) {
+  const char *seg[2];
+  size_t len[2];
+  size_t offset = 0;
+  int count = 0;
+
+  if (buffer_readable(b, seg, len) < 2) {
+    len[1] = 0;
+  }
+  while (max <= 0 || count < max) {
+    size_t remain = b->size - offset;
+    size_t sz;
+    if (remain < (size_t)header_len) {
+      break;
+    }
+    sz = _decode_header(b, seg, len, offset, header_len, big);
+    if (remain - header_len < sz) {
+      break;
+    }
+    _pushseg(L, b, seg, len, offset + header_len, sz);
+    if (out) {
+      lua_rawseti(L, out, ++count);
+    } else {
+      ++count;
+    }
+    offset += header_len + sz;
+  }
+  buffer_drop(b, offset);
+  return count;
+}
+
+static int
+lcreate(lua_State *L) {
+  lua_Integer cap = luaL_optinteger(L, 1, 0);
+  struct buffer *b = (struct buffer *)lua_newuserdata(L, sizeof(*b));
+  buffer_init(b);
+  luaL_getmetatable(L, BUFFER_METATABLE);
+  lua_setmetatable(L, -2);
+  if (cap > 0) {
+    _check_push(L, buffer_reserve(b, (size_t)cap));
+  }
+  return 1;
+}
+
+static int
+lpush(lua_State *L) {
+  struct buffer *b = _getbuffer(L, 1);
+  size_t sz;
+  const char *data = luaL_checklstring(L, 2, &sz);
+  _check_push(L, buffer_push(b, data, sz));
+  return 0;
+}
+
+static int
+llook(lua_State *L) {
+  struct buffer *b = _getbuffer(L, 1);
+  lua_Integer n = luaL_checkinteger(L, 2);
+  if (n > 0 && (size_t)n <= b->size) {
+    _pushrange(L, b, 0, (size_t)n);
+  } else {
+    lua_pushboolean(L, 0);
+  }
+  return 1;
+}
+
+/*
+ *  args: [int nbytes]
+ *  pop nbytes, or everything when nbytes is omitted.
+ */
+static int
+lpop(lua_State *L) {
+  struct buffer *b = _getbuffer(L, 1);
+  lua_Integer n = luaL_optinteger(L, 2, (lua_Integer)b->size);
+  if (n > 0 && (size_t)n <= b->size) {
+    _pushrange(L, b, 0, (size_t)n);
+    buffer_drop(b, (size_t)n);
+  } else {
+    lua_pushboolean(L, 0);
+  }
+  return 1;
+}
+
+static int
+lpop_all(lua_State *L) {
+  struct buffer *b = _getbuffer(L, 1);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  if (b->size == 0) {
+    lua_pushinteger(L, 0);
+    return 1;
+  }
+  _pushrange(L, b, 0, b->size);
+  lua_rawseti(L, 2, 1);
+  buffer_clear(b);
+  lua_pushinteger(L, 1);
+  return 1;
+}
+
+static void
+_check_frame_size(lua_State *L, size_t sz, int header_len) {
+  if (header_len < (int)sizeof(size_t) && (sz >> (header_len * 8)) != 0) {
+    luaL_error(L, "data size %d overflow header length %d", (int)sz, header_len);
+  }
+}
+
+/* append header and payload, room must be reserved */
+static void
+_push_frame(struct buffer *b, const char *data, size_t sz, int header_len, int big) {
+  uint8_t header[MAX_HEADER_LEN];
+  _encode_header(header, sz, header_len, big);
+  buffer_push(b, header, header_len);
+  buffer_push(b, data, sz);
+}
+
+/* validate list[first..last], return the framed size */
+static size_t
+_frames_size(lua_State *L, int list, lua_Integer first, lua_Integer last, int header_len) {
+  size_t total = 0;
+  lua_Integer i;
+  for (i=first; i<=last; i++) {
+    size_t sz;
+    lua_rawgeti(L, list, i);
+    if (lua_type(L, -1) != LUA_TSTRING) {
+      luaL_error(L, "list[%d] is not a string", (int)i);
+    }
+    sz = lua_rawlen(L, -1);
+    lua_pop(L, 1);
+    _check_frame_size(L, sz, header_len);
+    total += header_len + sz;
+  }
+  return total;
+}
+
+/* frame list[first..last] into b with a single reservation, return bytes */
+static size_t
+_push_frames(lua_State *L, struct buffer *b, int list, lua_Integer first, lua_Integer last, int header_len, int big) {
+  size_t total = _frames_size(L, list, first, last, header_len);
+  lua_Integer i;
+  _check_push(L, buffer_reserve(b, total));
+  for (i=first; i<=last; i++) {
+    size_t sz;
+    const char *data;
+    lua_rawgeti(L, list, i);
+    data = lua_tolstring(L, -1, &sz);
+    _push_frame(b, data, sz, header_len, big);
+    lua_pop(L, 1);
+  }
+  return total;
+}
+
+static int
+lpush_block(lua_State *L) {
+  struct buffer *b = _getbuffer(L, 1);
+  size_t sz;
+  const char *data = luaL_checklstring(L, 2, &sz);
+  int header_len = _check_header_len(L, 3);
+  int big = _check_endian(L, 4);
+
+  _check_frame_size(L, sz, header_len);
+  _check_push(L, buffer_reserve(b, header_len + sz));
+  _push_frame(b, data, sz, header_len, big);
+  return 0;
+}
+
+/*
+ *  args: table list, int header_len, string endian[, int first[, int last]]
+ *  frame every string of list[first..last], return the bytes appended.
+ */
+static int
+lpush_blocks(lua_State *L) {
+  struct buffer *b = _getbuffer(L, 1);
+  int header_len, big;
+  lua_Integer first, last;
+  luaL_checktype(L, 2, LUA_TTABLE);
+  header_len = _check_header_len(L, 3);
+  big = _check_endian(L, 4);
+  first = luaL_optinteger(L, 5, 1);
+  last = luaL_optinteger(L, 6, (lua_Integer)lua_rawlen(L, 2));
+
+  lua_pushinteger(L, (lua_Integer)_push_frames(L, b, 2, first, last, header_len, big));
+  return 1;
+}
+
+static int
+lpop_block(lua_State *L) {
+  struct buffer *b = _getbuffer(L, 1);
+  int header_len = _check_header_len(L, 2);
+  int big = _check_endian(L, 3);
+  if (_pop_frames(L, b, 0, header_len, big, 1) == 0) {
+    lua_pushboolean(L, 0);
+  }
+  return 1;
+}
+
+/*
+ *  args: table out, int header_len, string endian[, int max]
+ *  fill out[1..n] with at most max complete messages, return n.
+ */
+static int
+lpop_all_block(lua_State *L) {
+  struct buffer *b = _getbuffer(L, 1);
+  int header_len, big, max;
+  luaL_checktype(L, 2, LUA_TTABLE);
+  header_len = _check_header_len(L, 3);
+  big = _check_endian(L, 4);
+  max = (int)luaL_optinteger(L, 5, 0);
+
+  lua_pushinteger(L, _pop_frames(L, b, 2, header_len, big, max));
+  return 1;
+}
+
+/*
+ *  args: dst buffer, int nbytes
+ *  append the newest nbytes to dst, the buffer is unchanged.
+ */
+static int
+lcopy_tail(lua_State *L) {
+  struct buffer *b = _getbuffer(L, 1);
+  struct buffer *dst = _getbuffer(L, 2);
+  lua_Integer n = luaL_checkinteger(L, 3);
+  luaL_argcheck(L, dst != b, 2, "same buffer");
+  if (n < 0 || (size_t)n > b->size) {
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+  _check_push(L, buffer_copy(dst, b, b->size - (size_t)n, (size_t)n));
+  lua_pushinteger(L, n);
+  return 1;
+}
+
+/*
+ *  args: int max
+ *  keep only the newest max bytes, return the dropped size.
+ */
+static int
+ltrim(lua_State *L) {
+  struct buffer *b = _getbuffer(L, 1);
+  lua_Integer max = luaL_checkinteger(L, 2);
+  size_t n = 0;
+  luaL_argcheck(L, max >= 0, 2, "negative size");
+  if (b->size > (size_t)max) {
+    n = b->size - (size_t)max;
+    buffer_drop(b, n);
+  }
+  lua_pushinteger(L, (lua_Integer)n);
+  return 1;
+}
+
+static int
+lclear(lua_State *L) {
+  struct buffer *b = _getbuffer(L, 1);
+  buffer_clear(b);
+  return 0;
+}
+
+/* the first contiguous readable segment */
+static int
+lget_head_data(lua_State *L) {
+  struct buffer *b = _getbuffer(L, 1);
+  const char *seg[2];
+  size_t len[2];
+  if (buffer_readable(b, seg, len) == 0) {
+    lua_pushboolean(L, 0);
+  } else {
+    lua_pushlstring(L, seg[0], len[0]);
+  }
+  return 1;
+}
+
+static int
+lsize(lua_State *L) {
+  struct buffer *b = _getbuffer(L, 1);
+  lua_pushinteger(L, (lua_Integer)b->size);
+  return 1;
+}
+
+/* the layout of the buffer as a string, for debugging */
+static int
+ldump(lua_State *L) {
+  struct buffer *b = _getbuffer(L, 1);
+  const char *seg[2];
+  size_t len[2];
+  luaL_Buffer lb;
+  int i, count = buffer_readable(b, seg, len);
+  luaL_buffinit(L, &lb);
+  lua_pushfstring(L, "buffer %p cap:%d head:%d size:%d",
+    (void *)b, (int)b->cap, (int)b->head, (int)b->size);
+  luaL_addvalue(&lb);
+  for (i=0; i<count; i++) {
+    lua_pushfstring(L, " seg[%d] len:%d", i, (int)len[i]);
+    luaL_addvalue(&lb);
+  }
+  luaL_pushresult(&lb);
+  return 1;
+}
+
+static int
+lgc(lua_State *L) {
+  struct buffer *b = _getbuffer(L, 1);
+  buffer_free(b);
+  return 0;
+}
+
+static int
+ltostring(lua_State *L) {
+  struct buffer *b = _getbuffer(L, 1);
+  lua_pushfstring(L, "buffer: %p", b);
+  return 1;
+}
+
+/*
+ *  buffer.pack(data, header_len, endian)
+ *  buffer.pack(list, header_len, endian[, first[, last]])
+ *  return the framed message(s) as one string.
+ */
+static int
+lpack(lua_State *L) {
+  int header_len = _check_header_len(L, 2);
+  int big = _check_endian(L, 3);
+  uint8_t header[MAX_HEADER_LEN];
+  luaL_Buffer lb;
+  char *p;
+
+  if (lua_type(L, 1) == LUA_TTABLE) {
+    lua_Integer first = luaL_optinteger(L, 4, 1);
+    lua_Integer last = luaL_optinteger(L, 5, (lua_Integer)lua_rawlen(L, 1));
+    size_t total = _frames_size(L, 1, first, last, header_len);
+    lua_Integer i;
+    p = luaL_buffinitsize(L, &lb, total);
+    for (i=first; i<=last; i++) {
+      size_t sz;
+      const char *data;
+      lua_rawgeti(L, 1, i);
+      data = lua_tolstring(L, -1, &sz);
+      _encode_header(header, sz, header_len, big);
+      memcpy(p, header, header_len);
+      memcpy(p + header_len, data, sz);
+      p += header_len + sz;
+      lua_pop(L, 1);
+    }
+    luaL_pushresultsize(&lb, total);
+  } else {
+    size_t sz;
+    const char *data = luaL_checklstring(L, 1, &sz);
+    _check_frame_size(L, sz, header_len);
+    _encode_header(header, sz, header_len, big);
+    p = luaL_buffinitsize(L, &lb, header_len + sz);
+    memcpy(p, header, header_len);
+    memcpy(p + header_len, data, sz);
+    luaL_pushresultsize(&lb, header_len + sz);
+  }
+  return 1;
+}
+
+int
+luaopen_buffer_c(lua_State *L) {
+  luaL_checkversion(L);
+
+  if (luaL_newmetatable(L, BUFFER_METATABLE)) {
+    luaL_Reg buffer_mt[] = {
+      { "__gc", lgc },
+      { "__tostring", ltostring },
+      { NULL, NULL },
+    };
+    luaL_Reg buffer_methods[] = {
+      { "push", lpush },
+      { "look", llook },
+      { "pop", lpop },
+      { "pop_all", lpop_all },
+      { "push_block", lpush_block },
+      { "push_blocks", lpush_blocks },
+      { "pop_block", lpop_block },
+      { "pop_all_block", lpop_all_block },
+      { "copy_tail", lcopy_tail },
+      { "trim", ltrim },
+      { "clear", lclear },
+      { "get_head_data", lget_head_data },
+      { "size", lsize },
+      { "dump", ldump },
+      { NULL, NULL },
+    };
+    luaL_setfuncs(L, buffer_mt, 0);
+    luaL_newlib(L, buffer_methods);
+    lua_setfield(L, -2, "__index");
+  }
+  lua_pop(L, 1);
+
+  luaL_Reg l[] = {
+    { "create", lcreate },
+    { "pack", lpack },
+    { NULL, NULL },
+  };
+  luaL_newlib(L, l);
+  return 1;
+}
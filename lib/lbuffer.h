@@ -0,0 +1,11 @@
+#ifndef _LBUFFER_H_
+#define _LBUFFER_H_
+
+#include "lua.h"
+
+/* shared with the modules that read/write a buffer object directly */
+#define BUFFER_METATABLE "buffer_metatable"
+
+int luaopen_buffer_c(lua_State *L);
+
+#endif
@@ -9,6 +9,8 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include "crypt.h"
+
 #ifdef _MSC_VER
 #define random rand
 #define srandom srand
@@ -344,17 +346,9 @@ des_crypt( const uint32_t SK[32], const uint8_t input[8], uint8_t output[8] ) {
 
 static int
 lrandomkey(lua_State *L) {
-  char tmp[8];
-  int i;
-  char x = 0;
-  for (i=0;i<8;i++) {
-    tmp[i] = random() & 0xff;
-    x ^= tmp[i];
-  }
-  if (x==0) {
-    tmp[0] |= 1;  // avoid 0
-  }
-  lua_pushlstring(L, tmp, 8);
+  uint8_t tmp[8];
+  crypt_randomkey(tmp);
+  lua_pushlstring(L, (const char *)tmp, 8);
   return 1;
 }
 
@@ -444,42 +438,18 @@ ldesdecode(lua_State *L) {
 }
 
 
-static void
-Hash(const char * str, int sz, uint8_t key[8]) {
-  uint32_t djb_hash = 5381L;
-  uint32_t js_hash = 1315423911L;
-
-  int i;
-  for (i=0;i<sz;i++) {
-    uint8_t c = (uint8_t)str[i];
-    djb_hash += (djb_hash << 5) + c;
-    js_hash ^= ((js_hash << 5) + c + (js_hash >> 2));
-  }
-
-  key[0] = djb_hash & 0xff;
-  key[1] = (djb_hash >> 8) & 0xff;
-  key[2] = (djb_hash >> 16) & 0xff;
-  key[3] = (djb_hash >> 24) & 0xff;
-
-  key[4] = js_hash & 0xff;
-  key[5] = (js_hash >> 8) & 0xff;
-  key[6] = (js_hash >> 16) & 0xff;
-  key[7] = (js_hash >> 24) & 0xff;
-}
-
 static int
 lhashkey(lua_State *L) {
   size_t sz = 0;
   const char * key = luaL_checklstring(L, 1, &sz);
   uint8_t realkey[8];
-  Hash(key,(int)sz,realkey);
+  crypt_hashkey(key,sz,realkey);
   lua_pushlstring(L, (const char *)realkey, 8);
   return 1;
 }
 
 static int
 ltohex(lua_State *L) {
-  static char hex[] = "0123456789abcdef";
   size_t sz = 0;
   const uint8_t * text = (const uint8_t *)luaL_checklstring(L, 1, &sz);
   char tmp[SMALL_CHUNK];
@@ -487,17 +457,11 @@ ltohex(lua_State *L) {
   if (sz > SMALL_CHUNK/2) {
     buffer = lua_newuserdata(L, sz * 2);
   }
-  int i;
-  for (i=0;i<sz;i++) {
-    buffer[i*2] = hex[text[i] >> 4];
-    buffer[i*2+1] = hex[text[i] & 0xf];
-  }
+  crypt_tohex(text, sz, buffer);
   lua_pushlstring(L, buffer, sz * 2);
   return 1;
 }
 
-#define HEX(v,c) { char tmp = (char) c; if (tmp >= '0' && tmp <= '9') { v = tmp-'0'; } else { v = tmp - 'a' + 10; } }
-
 static int
 lfromhex(lua_State *L) {
   size_t sz = 0;
@@ -510,128 +474,13 @@ lfromhex(lua_State *L) {
   if (sz > SMALL_CHUNK*2) {
     buffer = lua_newuserdata(L, sz / 2);
   }
-  int i;
-  for (i=0;i<sz;i+=2) {
-    uint8_t hi,low;
-    HEX(hi, text[i]);
-    HEX(low, text[i+1]);
-    if (hi > 16 || low > 16) {
-      return luaL_error(L, "Invalid hex text", text);
-    }
-    buffer[i/2] = hi<<4 | low;
+  if (crypt_fromhex(text, sz, (uint8_t *)buffer) < 0) {
+    return luaL_error(L, "Invalid hex text");
   }
-  lua_pushlstring(L, buffer, i/2);
+  lua_pushlstring(L, buffer, sz / 2);
   return 1;
 }
 
-// Constants are the integer part of the sines of integers (in radians) * 2^32.
-static const uint32_t k[64] = {
-0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee ,
-0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501 ,
-0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be ,
-0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821 ,
-0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa ,
-0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8 ,
-0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed ,
-0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a ,
-0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c ,
-0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70 ,
-0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05 ,
-0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665 ,
-0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039 ,
-0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1 ,
-0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1 ,
-0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391 };
- 
-// r specifies the per-round shift amounts
-static const uint32_t r[] = {7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
-            5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
-            4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
-            6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
- 
-// leftrotate function definition
-#define LEFTROTATE(x, c) (((x) << (c)) | ((x) >> (32 - (c))))
-
-static void
-digest_md5(uint32_t w[16], uint32_t result[4]) {
-  uint32_t a, b, c, d, f, g, temp;
-  int i;
- 
-  a = 0x67452301u;
-  b = 0xefcdab89u;
-  c = 0x98badcfeu;
-  d = 0x10325476u;
-
-  for(i = 0; i<64; i++) {
-    if (i < 16) {
-      f = (b & c) | ((~b) & d);
-      g = i;
-    } else if (i < 32) {
-      f = (d & b) | ((~d) & c);
-      g = (5*i + 1) % 16;
-    } else if (i < 48) {
-      f = b ^ c ^ d;
-      g = (3*i + 5) % 16; 
-    } else {
-      f = c ^ (b | (~d));
-      g = (7*i) % 16;
-    }
-
-    temp = d;
-    d = c;
-    c = b;
-    b = b + LEFTROTATE((a + f + k[i] + w[g]), r[i]);
-    a = temp;
-  }
-
-  result[0] = a;
-  result[1] = b;
-  result[2] = c;
-  result[3] = d;
-}
-
-// hmac64 use md5 algorithm without padding, and the result is (c^d .. a^b)
-static void
-hmac(uint32_t x[2], uint32_t y[2], uint32_t result[2]) {
-  uint32_t w[16];
-  uint32_t r[4];
-  int i;
-  for (i=0;i<16;i+=4) {
-    w[i] = x[1];
-    w[i+1] = x[0];
-    w[i+2] = y[1];
-    w[i+3] = y[0];
-  }
-
-  digest_md5(w,r);
-
-  result[0] = r[2]^r[3];
-  result[1] = r[0]^r[1];
-}
-
-static void
-hmac_md5(uint32_t x[2], uint32_t y[2], uint32_t result[2]) {
-  uint32_t w[16];
-  uint32_t r[4];
-  int i;
-  for (i=0;i<12;i+=4) {
-    w[i] = x[0];
-    w[i+1] = x[1];
-    w[i+2] = y[0];
-    w[i+3] = y[1];
-  }
-
-  w[12] = 0x80;
-  w[13] = 0;
-  w[14] = 384;
-  w[15] = 0;
-
-  digest_md5(w,r);
-
-  result[0] = (r[0] + 0x67452301u) ^ (r[2] + 0x98badcfeu);
-  result[1] = (r[1] + 0xefcdab89u) ^ (r[3] + 0x10325476u);
-}
-
 static void
 read64(lua_State *L, uint32_t xx[2], uint32_t yy[2]) {
   size_t sz = 0;
@@ -670,7 +519,7 @@ lhmac64(lua_State *L) {
   uint32_t x[2], y[2];
   read64(L, x, y);
   uint32_t result[2];
-  hmac(x,y,result);
+  crypt_hmac64(x,y,result);
   return pushqword(L, result);
 }
 
@@ -685,7 +534,7 @@ lhmac64_md5(lua_State *L) {
   uint32_t x[2], y[2];
   read64(L, x, y);
   uint32_t result[2];
-  hmac_md5(x,y,result);
+  crypt_hmac64_md5(x,y,result);
   return pushqword(L, result);
 }
 
@@ -705,63 +554,15 @@ lhmac_hash(lua_State *L) {
   key[1] = x[4] | x[5]<<8 | x[6]<<16 | x[7]<<24;
   const char * text = luaL_checklstring(L, 2, &sz);
   uint8_t h[8];
-  Hash(text,(int)sz,h);
+  crypt_hashkey(text,sz,h);
   uint32_t htext[2];
   htext[0] = h[0] | h[1]<<8 | h[2]<<16 | h[3]<<24;
   htext[1] = h[4] | h[5]<<8 | h[6]<<16 | h[7]<<24;
   uint32_t result[2];
-  hmac(htext,key,result);
+  crypt_hmac64(htext,key,result);
   return pushqword(L, result);
 }
 
-// powmodp64 for DH-key exchange
-
-// The biggest 64bit prime
-#define P 0xffffffffffffffc5ull
-
-static inline uint64_t
-mul_mod_p(uint64_t a, uint64_t b) {
-  uint64_t m = 0;
-  while(b) {
-    if(b&1) {
-      uint64_t t = P-a;
-      if ( m >= t) {
-        m -= t;
-      } else {
-        m += a;
-      }
-    }
-    if (a >= P - a) {
-      a = a * 2 - P;
-    } else {
-      a = a * 2;
-    }
-    b>>=1;
-  }
-  return m;
-}
-
-static inline uint64_t
-pow_mod_p(uint64_t a, uint64_t b) {
-  if (b==1) {
-    return a;
-  }
-  uint64_t t = pow_mod_p(a, b>>1);
-  t = mul_mod_p(t,t);
-  if (b % 2) {
-    t = mul_mod_p(t, a);
-  }
-  return t;
-}
-
-// calc a^b % p
-static uint64_t
-powmodp(uint64_t a, uint64_t b) {
-  if (a > P)
-    a%=P;
-  return pow_mod_p(a,b);
-}
-
 static void
 push64(lua_State *L, uint64_t r) {
   uint8_t tmp[8];
@@ -785,15 +586,13 @@ ldhsecret(lua_State *L) {
   uint64_t yy = (uint64_t)y[0] | (uint64_t)y[1]<<32;
   if (xx == 0 || yy == 0)
     return luaL_error(L, "Can't be 0");
-  uint64_t r = powmodp(xx, yy);
+  uint64_t r = crypt_powmodp(xx, yy);
 
   push64(L, r);
 
   return 1;
 }
 
-#define G 5
-
 static int
 ldhexchange(lua_State *L) {
   size_t sz = 0;
@@ -809,7 +608,7 @@ ldhexchange(lua_State *L) {
   if (x64 == 0)
     return luaL_error(L, "Can't be 0");
 
-  uint64_t r = powmodp(G, x64);
+  uint64_t r = crypt_powmodp(CRYPT_DH_G, x64);
   push64(L, r);
   return 1;
 }
@@ -818,124 +617,68 @@ ldhexchange(lua_State *L) {
 
 static int
 lb64encode(lua_State *L) {
-  static const char* encoding = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
   size_t sz = 0;
   const uint8_t * text = (const uint8_t *)luaL_checklstring(L, 1, &sz);
-  int encode_sz = (sz + 2)/3*4;
+  size_t encode_sz = CRYPT_B64_ENCODE_SIZE(sz);
   char tmp[SMALL_CHUNK];
   char *buffer = tmp;
   if (encode_sz > SMALL_CHUNK) {
     buffer = lua_newuserdata(L, encode_sz);
   }
-  int i,j;
-  j=0;
-  for (i=0;i<(int)sz-2;i+=3) {
-    uint32_t v = text[i] << 16 | text[i+1] << 8 | text[i+2];
-    buffer[j] = encoding[v >> 18];
-    buffer[j+1] = encoding[(v >> 12) & 0x3f];
-    buffer[j+2] = encoding[(v >> 6) & 0x3f];
-    buffer[j+3] = encoding[(v) & 0x3f];
-    j+=4;
-  }
-  int padding = sz-i;
-  uint32_t v;
-  switch(padding) {
-  case 1 :
-    v = text[i];
-    buffer[j] = encoding[v >> 2];
-    buffer[j+1] = encoding[(v & 3) << 4];
-    buffer[j+2] = '=';
-    buffer[j+3] = '=';
-    break;
-  case 2 :
-    v = text[i] << 8 | text[i+1];
-    buffer[j] = encoding[v >> 10];
-    buffer[j+1] = encoding[(v >> 4) & 0x3f];
-    buffer[j+2] = encoding[(v & 0xf) << 2];
-    buffer[j+3] = '=';
-    break;
-  }
+  encode_sz = crypt_b64encode(text, sz, buffer);
   lua_pushlstring(L, buffer, encode_sz);
   return 1;
 }
 
-static inline int
-b64index(uint8_t c) {
-  static const int decoding[] = {62,-1,-1,-1,63,52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-2,-1,-1,-1,0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,-1,-1,-1,-1,-1,-1,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,41,42,43,44,45,46,47,48,49,50,51};
-  int decoding_size = sizeof(decoding)/sizeof(decoding[0]);
-  if (c<43) {
-    return -1;
-  }
-  c -= 43;
-  if (c>=decoding_size)
-    return -1;
-  return decoding[c];
-}
-
 static int
 lb64decode(lua_State *L) {
   size_t sz = 0;
   const uint8_t * text = (const uint8_t *)luaL_checklstring(L, 1, &sz);
-  int decode_sz = (sz+3)/4*3;
+  int strict = lua_toboolean(L, 2);
+  size_t decode_sz = CRYPT_B64_DECODE_SIZE(sz);
   char tmp[SMALL_CHUNK];
   char *buffer = tmp;
   if (decode_sz > SMALL_CHUNK) {
     buffer = lua_newuserdata(L, decode_sz);
   }
-  int i,j;
-  int output = 0;
-  for (i=0;i<sz;) {
-    int padding = 0;
-    int c[4];
-    for (j=0;j<4;) {
-      if (i>=sz) {
-        return luaL_error(L, "Invalid base64 text");
-      }
-      c[j] = b64index(text[i]);
-      if (c[j] == -1) {
-        ++i;
-        continue;
-      }
-      if (c[j] == -2) {
-        ++padding;
-      }
-      ++i;
-      ++j;
-    }
-    uint32_t v;
-    switch (padding) {
-    case 0:
-      v = (unsigned)c[0] << 18 | c[1] << 12 | c[2] << 6 | c[3];
-      buffer[output] = v >> 16;
-      buffer[output+1] = (v >> 8) & 0xff;
-      buffer[output+2] = v & 0xff;
-      output += 3;
-      break;
-    case 1:
-      if (c[3] != -2 || (c[2] & 3)!=0) {
-        return luaL_error(L, "Invalid base64 text");
-      }
-      v = (unsigned)c[0] << 10 | c[1] << 4 | c[2] >> 2 ;
-      buffer[output] = v >> 8;
-      buffer[output+1] = v & 0xff;
-      output += 2;
-      break;
-    case 2:
-      if (c[3] != -2 || c[2] != -2 || (c[1] & 0xf) !=0)  {
-        return luaL_error(L, "Invalid base64 text");
-      }
-      v = (unsigned)c[0] << 2 | c[1] >> 4;
-      buffer[output] = v;
-      ++ output;
-      break;
-    default:
-      return luaL_error(L, "Invalid base64 text");
-    }
+  int output = crypt_b64decode(text, sz, (uint8_t *)buffer, strict);
+  if (output < 0) {
+    return luaL_error(L, "Invalid base64 text");
   }
   lua_pushlstring(L, buffer, output);
   return 1;
 }
 
+// crypt.simd([level]) returns the level in effect: "scalar", "sse" or "avx2".
+// setting a level can only lower it below what the cpu supports.
+static int
+lsimd(lua_State *L) {
+  static const char *const levels[] = { "scalar", "sse", "avx2", NULL };
+  int level;
+  if (lua_isnoneornil(L, 1)) {
+    level = crypt_simd();
+  } else {
+    level = crypt_simd_set(luaL_checkoption(L, 1, NULL, levels));
+  }
+  lua_pushstring(L, levels[level]);
+  return 1;
+}
+
+// crypt.dhmul([mul]) returns the multiply dhexchange and dhsecret use:
+// "serial" or "int128". "int128" is only there when the compiler has it.
+static int
+ldhmul(lua_State *L) {
+  static const char *const muls[] = { "serial", "int128", NULL };
+  int mul;
+  if (lua_isnoneornil(L, 1)) {
+    mul = crypt_dh_mul();
+  } else {
+    mul = crypt_dh_mul_set(luaL_checkoption(L, 1, NULL, muls));
+  }
+  lua_pushstring(L, muls[mul]);
+  return 1;
+}
+
 static int
 lxor_str(lua_State *L) {
   size_t len1,len2;
@@ -946,10 +689,7 @@ lxor_str(lua_State *L) {
   }
   luaL_Buffer b;
   char * buffer = luaL_buffinitsize(L, &b, len1);
-  int i;
-  for (i=0;i<len1;i++) {
-    buffer[i] = s1[i] ^ s2[i % len2];
-  }
+  crypt_xor((const uint8_t *)s1, len1, (const uint8_t *)s2, len2, (uint8_t *)buffer);
   luaL_addsize(&b, len1);
   luaL_pushresult(&b);
   return 1;
@@ -980,6 +720,8 @@ luaopen_crypt(lua_State *L) {
     { "base64decode", lb64decode },
     { "hmac_hash", lhmac_hash },
     { "xor_str", lxor_str },
+    { "simd", lsimd },
+    { "dhmul", ldhmul },
     { NULL, NULL },
   };
   luaL_newlib(L,l);
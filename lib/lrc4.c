@@ -5,6 +5,8 @@
 #include "lauxlib.h"
 
 #include "rc4.h"
+#include "buffer.h"
+#include "lbuffer.h"
 
 #include <stdlib.h>
 
@@ -39,21 +41,106 @@ lreset(lua_State* L) {
 }
 
 
+/* crypt n bytes into the tail of dst */
+static void
+_crypt_into(lua_State *L, struct rc4_state *rc4, const uint8_t *data, size_t n, struct buffer *dst) {
+  char *seg[2];
+  size_t len[2];
+  size_t first;
+  if (buffer_reserve(dst, n) != 0) {
+    luaL_error(L, "rc4: out of memory");
+  }
+  buffer_writable(dst, seg, len);
+  first = n < len[0] ? n : len[0];
+  librc4_crypt(rc4, data, (uint8_t*)seg[0], (int)first);
+  if (first < n) {
+    librc4_crypt(rc4, data + first, (uint8_t*)seg[1], (int)(n - first));
+  }
+  buffer_commit(dst, n);
+}
+
+/*
+ * rc4:crypt(data) --> string
+ * rc4:crypt(data, dst) --> n, append the result to buffer dst
+ * rc4:crypt(src, dst) --> n, move everything of buffer src into dst
+ */
 static int
 lcrypt(lua_State * L) {
   struct rc4_state * rc4 = (struct rc4_state *)luaL_checkudata(L, 1, RC4_METATABLE);
-
+  struct buffer *dst = NULL;
   size_t len;
-  const char * data = luaL_checklstring(L, 2, &len);
 
-  uint8_t *buffer = (uint8_t *)malloc(len);
-  if(buffer) {
-    librc4_crypt(rc4, (const uint8_t*)data, buffer, (int)len);
-    lua_pushlstring(L, (const char*)buffer, len);
-    free(buffer);
+  if (!lua_isnoneornil(L, 3)) {
+    dst = (struct buffer *)luaL_checkudata(L, 3, BUFFER_METATABLE);
+  }
+
+  if (lua_type(L, 2) == LUA_TUSERDATA) {
+    struct buffer *src = (struct buffer *)luaL_checkudata(L, 2, BUFFER_METATABLE);
+    const char *seg[2];
+    size_t seglen[2];
+    int i, count;
+    luaL_argcheck(L, dst != NULL && dst != src, 3, "need another buffer");
+    /* one reservation for the whole move */
+    len = src->size;
+    if (buffer_reserve(dst, len) != 0) {
+      return luaL_error(L, "rc4: out of memory");
+    }
+    count = buffer_readable(src, seg, seglen);
+    for (i=0; i<count; i++) {
+      _crypt_into(L, rc4, (const uint8_t*)seg[i], seglen[i], dst);
+    }
+    buffer_clear(src);
+    lua_pushinteger(L, (lua_Integer)len);
+    return 1;
+  }
+
+  const char * data = luaL_checklstring(L, 2, &len);
+  if (dst) {
+    _crypt_into(L, rc4, (const uint8_t*)data, len, dst);
+    lua_pushinteger(L, (lua_Integer)len);
     return 1;
   }
 
+  luaL_Buffer b;
+  uint8_t *buffer = (uint8_t *)luaL_buffinitsize(L, &b, len);
+  librc4_crypt(rc4, (const uint8_t*)data, buffer, (int)len);
+  luaL_pushresultsize(&b, len);
+  return 1;
+}
+
+/*
+ * rc4:crypt_buffer(buf[, from[, len]])
+ * crypt a range of buffer in place, from is 0 based. default is all.
+ */
+static int
+lcrypt_buffer(lua_State * L) {
+  struct rc4_state * rc4 = (struct rc4_state *)luaL_checkudata(L, 1, RC4_METATABLE);
+  struct buffer *buf = (struct buffer *)luaL_checkudata(L, 2, BUFFER_METATABLE);
+  lua_Integer from = luaL_optinteger(L, 3, 0);
+  lua_Integer n;
+  const char *seg[2];
+  size_t len[2];
+  int i, count;
+
+  luaL_argcheck(L, from >= 0 && (size_t)from <= buf->size, 3, "out of range");
+  n = luaL_optinteger(L, 4, (lua_Integer)buf->size - from);
+  luaL_argcheck(L, n >= 0 && (size_t)(from + n) <= buf->size, 4, "out of range");
+
+  count = buffer_readable(buf, seg, len);
+  for (i=0; i<count && n>0; i++) {
+    size_t sz;
+    if ((size_t)from >= len[i]) {
+      from -= len[i];
+      continue;
+    }
+    sz = len[i] - from;
+    if (sz > (size_t)n) {
+      sz = (size_t)n;
+    }
+    librc4_crypt(rc4, (const uint8_t*)seg[i] + from, (uint8_t*)seg[i] + from, (int)sz);
+    n -= sz;
+    from = 0;
+  }
   return 0;
 }
 
@@ -64,6 +151,7 @@ luaopen_rc4_c(lua_State *L) {
   if(luaL_newmetatable(L, RC4_METATABLE)) {
     luaL_Reg rc4_mt[] = {
       { "crypt", lcrypt },
+      { "crypt_buffer", lcrypt_buffer },
       { "reset", lreset},
       { NULL, NULL },
     };
@@ -17,12 +17,28 @@ Module interface:
 - socket.socket(family, type[, proto]) --> new socket object
 - socket.AF_INET, socket.SOCK_STREAM, etc.: constants from <socket.h>
 - socket.resolve(hostname), hostname can be anything recognized by getaddrinfo
+- socket.poller() --> new readiness poller (epoll on linux, poll elsewhere,
+  not available on windows)
+- socket.resolver([threads]) --> new asynchronous resolver, getaddrinfo runs
+  on a thread pool, not available on windows
+- socket.gettime() --> monotonic clock in milliseconds
+- socket.gettime_us() --> monotonic clock in microseconds, for timing short
+  operations
+- socket.fork(), socket.socketpair(), socket.waitpid(pid[, nohang]),
+  socket.getpid(): process helpers for multi process servers, not available
+  on windows
 */
 #ifdef __MINGW32__
 #  define WINVER _WIN32_WINNT_WINXP
 #endif
 
+// dladdr
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#  define _GNU_SOURCE
+#endif
+
 #include <string.h>
+#include <stdlib.h>
 
 #ifdef _MSC_VER
 
@@ -74,18 +90,56 @@ typedef long     ssize_t;
 #include <sys/socket.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <dlfcn.h>
 #define socket_errno errno
 
+#include <poll.h>
+
+#ifdef __linux__
+#  define USE_EPOLL
+#  include <sys/epoll.h>
+#endif
+
 #endif
 
 #include "lsocket.h"
+#include "buffer.h"
+#include "lbuffer.h"
 
 #define SOCKET_METATABLE "socket_metatable"
+#define POLLER_METATABLE "poller_metatable"
+#define RESOLVER_METATABLE "resolver_metatable"
 
 #define RECV_BUFSIZE (4079)
 
+// free space kept in the buffer before each recv_into read
+#define RECV_INTO_RESERVE (16*1024)
+
+// iovec count of one sendv call
+#if defined(IOV_MAX) && IOV_MAX < 1024
+#define SENDV_MAX_IOV IOV_MAX
+#else
+#define SENDV_MAX_IOV (1024)
+#endif
+
+// poller event mask
+#define EVENT_READ  1
+#define EVENT_WRITE 2
+#define EVENT_ERROR 4
+
+#define POLLER_MAX_EVENTS (1024)
+
+#define RESOLVER_DEF_THREADS (2)
+#define RESOLVER_MAX_THREADS (64)
+
 /*
 #if !defined(NI_MAXHOST)
 #define NI_MAXHOST 1025
@@ -105,6 +159,12 @@ typedef struct _sock_t {
     // default: libev suppose you input operating-system file handle on windows
     int handle;
 #endif
+    // i/o counters, see sock:stat()
+    lua_Integer recv_calls;
+    lua_Integer send_calls;
+    lua_Integer eagain;
+    lua_Integer bytes_in;
+    lua_Integer bytes_out;
 } socket_t;
 
 /* 
@@ -134,6 +194,32 @@ _setsock(lua_State *L, int fd, int family, int type, int protocol) {
 #ifdef _WIN32
     nsock->handle = _open_osfhandle(fd, 0);
 #endif
+    nsock->recv_calls = 0;
+    nsock->send_calls = 0;
+    nsock->eagain = 0;
+    nsock->bytes_in = 0;
+    nsock->bytes_out = 0;
+}
+
+// count one recv/send syscall and its result
+INLINE static void
+_count_recv(socket_t *sock, ssize_t nread) {
+    sock->recv_calls++;
+    if(nread > 0) {
+        sock->bytes_in += nread;
+    } else if(nread < 0 && socket_errno == EAGAIN) {
+        sock->eagain++;
+    }
+}
+
+INLINE static void
+_count_send(socket_t *sock, ssize_t nwrite) {
+    sock->send_calls++;
+    if(nwrite > 0) {
+        sock->bytes_out += nwrite;
+    } else if(nwrite < 0 && socket_errno == EAGAIN) {
+        sock->eagain++;
+    }
 }
 
 static const char*
@@ -223,14 +309,34 @@ _socket(lua_State *L) {
     return 1;
 }
 
-// deprecated: may hang up, use dns.resolve for cooperative dns query
+/*
+ *   push {{family=, addr=}, ...} of the stream addresses in res
+ */
+static void
+_push_addrinfo(lua_State *L, struct addrinfo *res) {
+    char buf[INET6_ADDRSTRLEN];
+    int i = 1;
+    lua_newtable(L);
+    while(res) {
+        // ignore all unsupported address
+        if((res->ai_family == AF_INET || res->ai_family == AF_INET6) && res->ai_socktype == SOCK_STREAM) {
+            lua_createtable(L, 0, 2);
+            lua_pushinteger(L, res->ai_family);
+            lua_setfield(L, -2, "family");
+            lua_pushstring(L, _addr2string(res->ai_addr, buf, sizeof(buf)));
+            lua_setfield(L, -2, "addr");
+            lua_rawseti(L, -2, i++);
+        }
+        res = res->ai_next;
+    }
+}
+
+// deprecated: may hang up, use socket.resolver for asynchronous query
 static int
 _resolve(lua_State *L) {
     const char* host = luaL_checkstring(L, 1);
     struct addrinfo *res = 0;
-    struct addrinfo *p = NULL;
-	int err, i;
-	char buf[INET6_ADDRSTRLEN];
+	int err;
 
     struct addrinfo hints;
     memset(&hints, 0, sizeof(hints));
@@ -244,22 +350,8 @@ _resolve(lua_State *L) {
         return 2;
     }
 
-    i = 1;
-    lua_newtable(L);
-    p = res;
-    while(res) {
-        // ignore all unsupported address
-        if((res->ai_family == AF_INET || res->ai_family == AF_INET6) && res->ai_socktype == SOCK_STREAM) {
-            lua_createtable(L, 0, 2);
-            lua_pushinteger(L, res->ai_family);
-            lua_setfield(L, -2, "family");
-            lua_pushstring(L, _addr2string(res->ai_addr, buf, sizeof(buf)));
-            lua_setfield(L, -2, "addr");
-            lua_rawseti(L, -2, i++);
-        }
-        res = res->ai_next;
-    }
-    freeaddrinfo(p);
+    _push_addrinfo(L, res);
+    freeaddrinfo(res);
     return 1;
 }
 
@@ -311,6 +403,106 @@ _lgai_strerror(lua_State *L) {
     return 1;
 }
 
+static int
+_gettime(lua_State *L) {
+#ifdef _WIN32
+    lua_pushinteger(L, (lua_Integer)GetTickCount64());
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    lua_pushinteger(L, (lua_Integer)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#endif
+    return 1;
+}
+
+static int
+_gettime_us(lua_State *L) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    lua_pushinteger(L, (lua_Integer)(now.QuadPart / freq.QuadPart * 1000000
+        + now.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart));
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    lua_pushinteger(L, (lua_Integer)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+#endif
+    return 1;
+}
+
+#ifndef _WIN32
+/* process helpers */
+static int
+_fork(lua_State *L) {
+    pid_t pid = fork();
+    if(pid < 0) {
+        lua_pushnil(L);
+        lua_pushinteger(L, errno);
+        return 2;
+    }
+    lua_pushinteger(L, pid);
+    return 1;
+}
+
+static int
+_getpid(lua_State *L) {
+    lua_pushinteger(L, getpid());
+    return 1;
+}
+
+/*
+ *   return two connected AF_UNIX stream socket objects
+ */
+static int
+_socketpair(lua_State *L) {
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        lua_pushnil(L);
+        lua_pushinteger(L, errno);
+        return 2;
+    }
+    _setsock(L, fds[0], AF_UNIX, SOCK_STREAM, 0);
+    _setsock(L, fds[1], AF_UNIX, SOCK_STREAM, 0);
+    return 2;
+}
+
+/*
+ *   args: int pid, [bool nohang]
+ *   return pid, exit code (or -signal when killed by a signal),
+ *   0 when nohang and the child is still running
+ */
+static int
+_waitpid(lua_State *L) {
+    pid_t pid = (pid_t)luaL_checkinteger(L, 1);
+    int options = lua_toboolean(L, 2) ? WNOHANG : 0;
+    int status = 0;
+    pid_t ret;
+
+    do {
+        ret = waitpid(pid, &status, options);
+    } while(ret < 0 && errno == EINTR);
+
+    if(ret < 0) {
+        lua_pushnil(L);
+        lua_pushinteger(L, errno);
+        return 2;
+    }
+    lua_pushinteger(L, ret);
+    if(ret == 0) {
+        return 1;
+    }
+    if(WIFEXITED(status)) {
+        lua_pushinteger(L, WEXITSTATUS(status));
+    } else if(WIFSIGNALED(status)) {
+        lua_pushinteger(L, -WTERMSIG(status));
+    } else {
+        lua_pushinteger(L, status);
+    }
+    return 2;
+}
+#endif // _WIN32
+
 
 /* socket object methods */
 static int
@@ -362,30 +554,47 @@ _sock_connect(lua_State *L) {
     }
 }
 
+/*
+ *   args: [boolean ready]
+ *   when ready is true, the caller already knows the socket is writable
+ *   (eg. from a poller), so the select() probe is skipped.
+ */
 static int
 _sock_check_async_connect(lua_State *L) {
     socket_t *sock = _getsock(L, 1);
+    int ready = lua_toboolean(L, 2);
 
-    fd_set fdset;
-    FD_ZERO(&fdset);
-    FD_SET(sock->fd, &fdset);
-
-    struct timeval tv;
-    tv.tv_sec = 0;
-    tv.tv_usec = 0;
-    int n = select(sock->fd+1, NULL, &fdset, NULL, &tv);
+    if(!ready) {
+#ifdef _WIN32
+        fd_set fdset;
+        FD_ZERO(&fdset);
+        FD_SET(sock->fd, &fdset);
+
+        struct timeval tv;
+        tv.tv_sec = 0;
+        tv.tv_usec = 0;
+        int n = select(sock->fd+1, NULL, &fdset, NULL, &tv);
+#else
+        // select can't take fd >= FD_SETSIZE
+        struct pollfd pfd;
+        pfd.fd = sock->fd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        int n = poll(&pfd, 1, 0);
+#endif
 
-    // not ready
-    if(n == 0) {
-      lua_pushboolean(L, 0);
-      return 1;
-    }
+        // not ready
+        if(n == 0) {
+          lua_pushboolean(L, 0);
+          return 1;
+        }
 
-    // error
-    if(n < 0) {
-      lua_pushboolean(L, 0);
-      lua_pushinteger(L, socket_errno);
-      return 2;
+        // error
+        if(n < 0) {
+          lua_pushboolean(L, 0);
+          lua_pushinteger(L, socket_errno);
+          return 2;
+        }
     }
 
     int err;
@@ -423,6 +632,7 @@ _sock_recv(lua_State *L) {
     // printf("before recv %d -> socket_errno:%d\n", sock->fd, socket_errno);
     // socket_errno = 3;
     nread = recv(sock->fd, buf, len, 0);
+    _count_recv(sock, nread);
     // printf("recv %d -> nread:%d socket_errno:%d\n", sock->fd, nread, socket_errno);
     if(nread <0) {
         lua_pushnil(L);
@@ -433,6 +643,104 @@ _sock_recv(lua_State *L) {
     return 1;
 }
 
+/*
+ *   args: buffer buf[, int max_bytes[, int max_reads]]
+ *   read directly into the tail of a native buffer, repeat until EAGAIN or
+ *   the budget is used up. 0 for max_bytes/max_reads means no limit.
+ *   return: nread (0 for peer closed), budget_hit
+ *           or nil, errno if nothing was read.
+ *   budget_hit is true when reading stopped because of the budget, so more
+ *   data may still be pending in the kernel.
+ */
+static int
+_sock_recv_into(lua_State *L) {
+    socket_t *sock = _getsock(L, 1);
+    struct buffer *buf = (struct buffer*)luaL_checkudata(L, 2, BUFFER_METATABLE);
+    size_t max_bytes = (size_t)luaL_optinteger(L, 3, 0);
+    lua_Integer max_reads = luaL_optinteger(L, 4, 0);
+    size_t total = 0;
+    lua_Integer reads = 0;
+    int err = 0;
+    int budget_hit = 0;
+
+    for(;;) {
+        char *seg[2];
+        size_t len[2];
+        size_t want = RECV_INTO_RESERVE;
+        ssize_t nread;
+        int count;
+
+        if(max_bytes > 0) {
+            if(total >= max_bytes) {
+                budget_hit = 1;
+                break;
+            }
+            if(max_bytes - total < want) {
+                want = max_bytes - total;
+            }
+        }
+        if(max_reads > 0 && reads >= max_reads) {
+            budget_hit = 1;
+            break;
+        }
+
+        if(buffer_reserve(buf, want) != 0) {
+            return luaL_error(L, "recv_into: out of memory");
+        }
+        count = buffer_writable(buf, seg, len);
+        if(len[0] >= want) {
+            len[0] = want;
+            count = 1;
+        } else if(count == 2 && len[0] + len[1] > want) {
+            len[1] = want - len[0];
+        }
+
+#ifdef _WIN32
+        nread = recv(sock->fd, seg[0], (int)len[0], 0);
+#else
+        if(count == 1) {
+            nread = recv(sock->fd, seg[0], len[0], 0);
+        } else {
+            struct iovec iov[2];
+            iov[0].iov_base = seg[0];
+            iov[0].iov_len = len[0];
+            iov[1].iov_base = seg[1];
+            iov[1].iov_len = len[1];
+            nread = readv(sock->fd, iov, 2);
+        }
+#endif
+        _count_recv(sock, nread);
+        reads++;
+        if(nread < 0) {
+            err = socket_errno;
+            if(err == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if(nread == 0) {
+            break;
+        }
+        buffer_commit(buf, (size_t)nread);
+        total += (size_t)nread;
+
+        // short read: kernel buffer is drained, skip the EAGAIN round trip
+        if((size_t)nread < len[0] + (count == 2 ? len[1] : 0)) {
+            break;
+        }
+    }
+
+    // report the error next time when some data was read
+    if(total == 0 && err != 0) {
+        lua_pushnil(L);
+        lua_pushinteger(L, err);
+        return 2;
+    }
+    lua_pushinteger(L, (lua_Integer)total);
+    lua_pushboolean(L, budget_hit);
+    return 2;
+}
+
 static int
 _sock_send(lua_State *L) {
     socket_t *sock = _getsock(L, 1);
@@ -450,6 +758,7 @@ _sock_send(lua_State *L) {
     }
 
     nwrite = send(sock->fd, buf+from, len - from, flags);
+    _count_send(sock, nwrite);
     if(nwrite < 0) {
         lua_pushnil(L);
         lua_pushinteger(L, socket_errno);
@@ -459,6 +768,103 @@ _sock_send(lua_State *L) {
     return 1;
 }
 
+#ifdef _WIN32
+typedef WSABUF iovec_t;
+#define IOV_SET(v, p, n) ((v).buf = (char*)(p), (v).len = (ULONG)(n))
+#else
+typedef struct iovec iovec_t;
+#define IOV_SET(v, p, n) ((v).iov_base = (void*)(p), (v).iov_len = (n))
+#endif
+
+static ssize_t
+_sendv(socket_t *sock, iovec_t *iov, int count) {
+#ifdef _WIN32
+    DWORD nwrite = 0;
+    if(WSASend(sock->fd, iov, count, &nwrite, 0, NULL, NULL) != 0) {
+        return -1;
+    }
+    return (ssize_t)nwrite;
+#else
+    struct msghdr msg;
+    int flags = 0;
+#ifdef MSG_NOSIGNAL
+    flags = MSG_NOSIGNAL;
+#endif
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    return sendmsg(sock->fd, &msg, flags);
+#endif
+}
+
+/*
+ *   args: buffer buf
+ *         table list[, int first[, int offset]]
+ *   gather write with one syscall.
+ *   buffer: the written bytes are dropped from buf.
+ *   list: send list[first], list[first+1]... skipping offset bytes of
+ *   list[first], at most SENDV_MAX_IOV strings.
+ *   return: nwrite or nil, errno
+ */
+static int
+_sock_sendv(lua_State *L) {
+    socket_t *sock = _getsock(L, 1);
+    iovec_t iov[SENDV_MAX_IOV];
+    struct buffer *buf = NULL;
+    int count = 0;
+    ssize_t nwrite;
+
+    if(lua_type(L, 2) == LUA_TTABLE) {
+        lua_Integer i = luaL_optinteger(L, 3, 1);
+        size_t offset = (size_t)luaL_optinteger(L, 4, 0);
+        lua_Integer n = (lua_Integer)lua_rawlen(L, 2);
+        for(; i<=n && count<SENDV_MAX_IOV; i++) {
+            size_t len;
+            const char *p;
+            lua_rawgeti(L, 2, i);
+            p = lua_tolstring(L, -1, &len);
+            lua_pop(L, 1);  // still referenced by the list
+            if(p == NULL) {
+                return luaL_error(L, "sendv: list[%d] is not a string", (int)i);
+            }
+            if(offset >= len) {
+                offset -= len;
+                continue;
+            }
+            IOV_SET(iov[count], p + offset, len - offset);
+            offset = 0;
+            count++;
+        }
+    } else {
+        const char *seg[2];
+        size_t len[2];
+        int i;
+        buf = (struct buffer*)luaL_checkudata(L, 2, BUFFER_METATABLE);
+        count = buffer_readable(buf, seg, len);
+        for(i=0; i<count; i++) {
+            IOV_SET(iov[i], seg[i], len[i]);
+        }
+    }
+
+    if(count == 0) {
+        lua_pushinteger(L, 0);
+        return 1;
+    }
+
+    nwrite = _sendv(sock, iov, count);
+    _count_send(sock, nwrite);
+    if(nwrite < 0) {
+        lua_pushnil(L);
+        lua_pushinteger(L, socket_errno);
+        return 2;
+    }
+    if(buf) {
+        buffer_drop(buf, (size_t)nwrite);
+    }
+    lua_pushinteger(L, nwrite);
+    return 1;
+}
+
 static int
 _sock_recvfrom(lua_State *L) {
     socklen_t addr_len;
@@ -475,6 +881,7 @@ _sock_recvfrom(lua_State *L) {
 
     addr = (struct sockaddr*)lua_newuserdata(L, addr_len);
     nread = recvfrom(sock->fd, buf, len, 0, addr, &addr_len);
+    _count_recv(sock, nread);
     if(nread < 0) {
         lua_pushnil(L);
         lua_pushinteger(L, socket_errno);
@@ -517,6 +924,7 @@ _sock_sendto(lua_State *L) {
     }
 
     nwrite = sendto(sock->fd, buf + from, len - from, flags, res->ai_addr, res->ai_addrlen);
+    _count_send(sock, nwrite);
     if(nwrite < 0) {
         lua_pushnil(L);
         lua_pushinteger(L, socket_errno);
@@ -576,6 +984,36 @@ _sock_accept(lua_State *L) {
     return 1;
 }
 
+/*
+ *   args: [table out]
+ *   i/o counters since the socket was created, filled into out if given:
+ *   recv_calls, send_calls: recv/send family syscalls issued
+ *   eagain: calls that failed with EAGAIN
+ *   bytes_in, bytes_out
+ *   return: table
+ */
+static int
+_sock_stat(lua_State *L) {
+    socket_t *sock = _getsock(L, 1);
+    if(lua_istable(L, 2)) {
+        lua_settop(L, 2);
+    } else {
+        lua_settop(L, 1);
+        lua_createtable(L, 0, 5);
+    }
+    lua_pushinteger(L, sock->recv_calls);
+    lua_setfield(L, -2, "recv_calls");
+    lua_pushinteger(L, sock->send_calls);
+    lua_setfield(L, -2, "send_calls");
+    lua_pushinteger(L, sock->eagain);
+    lua_setfield(L, -2, "eagain");
+    lua_pushinteger(L, sock->bytes_in);
+    lua_setfield(L, -2, "bytes_in");
+    lua_pushinteger(L, sock->bytes_out);
+    lua_setfield(L, -2, "bytes_out");
+    return 1;
+}
+
 static int
 _sock_fileno(lua_State *L) {
     socket_t *sock = _getsock(L, 1);
@@ -670,6 +1108,7 @@ _sock_setsockopt(lua_State *L) {
     const char* buf;
     size_t buflen;
     ssize_t type, err;
+    int flag;
 
     socket_t *sock = _getsock(L, 1);
     int level = (int)luaL_checkinteger(L, 2);
@@ -680,7 +1119,7 @@ _sock_setsockopt(lua_State *L) {
     if(type == LUA_TSTRING) {
         buf = luaL_checklstring(L, 4, &buflen);
     } else if(type == LUA_TNUMBER) {
-        int flag = (int)luaL_checkinteger(L, 4);
+        flag = (int)luaL_checkinteger(L, 4);
         buf = (const char*)&flag;
         buflen = sizeof(flag);
     } else {
@@ -717,6 +1156,703 @@ _sock_tostring(lua_State *L) {
 
 /* end */
 
+/* poller object */
+#ifndef _WIN32
+
+typedef struct _poller_t {
+    int fd;     // epoll fd, unused by poll backend
+    int count;  // registered fd count
+#ifndef USE_EPOLL
+    int cap;
+    struct pollfd *fds;
+#endif
+} poller_t;
+
+INLINE static poller_t*
+_getpoller(lua_State *L, int index) {
+    poller_t *poller = (poller_t*)luaL_checkudata(L, index, POLLER_METATABLE);
+    if(poller->count < 0) {
+        luaL_error(L, "poller is closed");
+    }
+    return poller;
+}
+
+#ifdef USE_EPOLL
+static uint32_t
+_to_native_events(int events) {
+    uint32_t ev = 0;
+    if(events & EVENT_READ) ev |= EPOLLIN;
+    if(events & EVENT_WRITE) ev |= EPOLLOUT;
+    return ev;
+}
+
+static int
+_from_native_events(uint32_t ev) {
+    int events = 0;
+    if(ev & EPOLLIN) events |= EVENT_READ;
+    if(ev & EPOLLOUT) events |= EVENT_WRITE;
+    if(ev & (EPOLLERR | EPOLLHUP)) events |= EVENT_ERROR;
+    return events;
+}
+
+static int
+_poller_ctl(poller_t *poller, int op, int fd, int events) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = _to_native_events(events);
+    ev.data.fd = fd;
+    return epoll_ctl(poller->fd, op, fd, &ev);
+}
+
+#else
+static short
+_to_native_events(int events) {
+    short ev = 0;
+    if(events & EVENT_READ) ev |= POLLIN;
+    if(events & EVENT_WRITE) ev |= POLLOUT;
+    return ev;
+}
+
+static int
+_from_native_events(short ev) {
+    int events = 0;
+    if(ev & POLLIN) events |= EVENT_READ;
+    if(ev & POLLOUT) events |= EVENT_WRITE;
+    if(ev & (POLLERR | POLLHUP | POLLNVAL)) events |= EVENT_ERROR;
+    return events;
+}
+
+// fallback backend only, linear lookup is acceptable here
+static int
+_poller_find(poller_t *poller, int fd) {
+    int i;
+    for(i=0; i<poller->count; i++) {
+        if(poller->fds[i].fd == fd) {
+            return i;
+        }
+    }
+    return -1;
+}
+#endif
+
+static int
+_poller(lua_State *L) {
+    poller_t *poller = (poller_t*)lua_newuserdata(L, sizeof(poller_t));
+    memset(poller, 0, sizeof(*poller));
+    poller->fd = -1;
+    poller->count = 0;
+#ifdef USE_EPOLL
+    poller->fd = epoll_create1(EPOLL_CLOEXEC);
+    if(poller->fd < 0) {
+        poller->count = -1;
+        lua_pushnil(L);
+        lua_pushinteger(L, socket_errno);
+        return 2;
+    }
+#endif
+    luaL_getmetatable(L, POLLER_METATABLE);
+    lua_setmetatable(L, -2);
+
+    // fd -> registered object
+    lua_newtable(L);
+    lua_setuservalue(L, -2);
+    return 1;
+}
+
+/*
+ *   args: socket sock, int events[, any obj]
+ *   obj is what wait() reports for this socket, default is sock itself.
+ */
+static int
+_poller_add(lua_State *L) {
+    poller_t *poller = _getpoller(L, 1);
+    socket_t *sock = _getsock(L, 2);
+    int events = (int)luaL_checkinteger(L, 3);
+    int fd = sock->fd;
+    if(fd < 0) {
+        return luaL_argerror(L, 2, "socket is closed");
+    }
+
+#ifdef USE_EPOLL
+    if(_poller_ctl(poller, EPOLL_CTL_ADD, fd, events) != 0) {
+        return _push_result(L, socket_errno);
+    }
+#else
+    if(_poller_find(poller, fd) >= 0) {
+        return _push_result(L, EEXIST);
+    }
+    if(poller->count == poller->cap) {
+        int cap = poller->cap ? poller->cap*2 : 64;
+        struct pollfd *fds = (struct pollfd*)realloc(poller->fds, cap * sizeof(struct pollfd));
+        if(!fds) {
+            return luaL_error(L, "poller: out of memory");
+        }
+        poller->fds = fds;
+        poller->cap = cap;
+    }
+    poller->fds[poller->count].fd = fd;
+    poller->fds[poller->count].events = _to_native_events(events);
+    poller->fds[poller->count].revents = 0;
+#endif
+    poller->count++;
+
+    if(lua_isnoneornil(L, 4)) {
+        lua_settop(L, 2);
+        lua_pushvalue(L, 2);
+    } else {
+        lua_settop(L, 4);
+    }
+    lua_getuservalue(L, 1);
+    lua_insert(L, -2);
+    lua_rawseti(L, -2, fd);
+    return _push_result(L, 0);
+}
+
+/*
+ *   args: socket sock, int events
+ */
+static int
+_poller_mod(lua_State *L) {
+    poller_t *poller = _getpoller(L, 1);
+    socket_t *sock = _getsock(L, 2);
+    int events = (int)luaL_checkinteger(L, 3);
+
+#ifdef USE_EPOLL
+    if(_poller_ctl(poller, EPOLL_CTL_MOD, sock->fd, events) != 0) {
+        return _push_result(L, socket_errno);
+    }
+#else
+    int i = _poller_find(poller, sock->fd);
+    if(i < 0) {
+        return _push_result(L, ENOENT);
+    }
+    poller->fds[i].events = _to_native_events(events);
+#endif
+    return _push_result(L, 0);
+}
+
+static int
+_poller_del(lua_State *L) {
+    poller_t *poller = _getpoller(L, 1);
+    socket_t *sock = _getsock(L, 2);
+    int fd = sock->fd;
+    if(fd < 0) {
+        return luaL_argerror(L, 2, "socket is closed");
+    }
+
+#ifdef USE_EPOLL
+    if(_poller_ctl(poller, EPOLL_CTL_DEL, fd, 0) != 0) {
+        return _push_result(L, socket_errno);
+    }
+#else
+    int i = _poller_find(poller, fd);
+    if(i < 0) {
+        return _push_result(L, ENOENT);
+    }
+    poller->fds[i] = poller->fds[poller->count-1];
+#endif
+    poller->count--;
+
+    lua_getuservalue(L, 1);
+    lua_pushnil(L);
+    lua_rawseti(L, -2, fd);
+    return _push_result(L, 0);
+}
+
+/*
+ *   args: table objs, table events[, int timeout_ms]
+ *   fill objs[i] and events[i] for every ready socket, return the count.
+ *   timeout: 0 return immediately(default), <0 block until ready.
+ */
+static int
+_poller_wait(lua_State *L) {
+    poller_t *poller = _getpoller(L, 1);
+    int timeout = (int)luaL_optinteger(L, 4, 0);
+    int i, n, count = 0;
+    luaL_checktype(L, 2, LUA_TTABLE);
+    luaL_checktype(L, 3, LUA_TTABLE);
+    lua_settop(L, 3);
+    lua_getuservalue(L, 1);
+
+#ifdef USE_EPOLL
+    struct epoll_event evs[POLLER_MAX_EVENTS];
+    n = epoll_wait(poller->fd, evs, POLLER_MAX_EVENTS, timeout);
+    if(n < 0) {
+        int err = socket_errno;
+        lua_pushinteger(L, 0);
+        if(err == EINTR) {
+            return 1;
+        }
+        lua_pushinteger(L, err);
+        return 2;
+    }
+    for(i=0; i<n; i++) {
+        int fd = evs[i].data.fd;
+        if(lua_rawgeti(L, 4, fd) == LUA_TNIL) {
+            lua_pop(L, 1);
+            continue;
+        }
+        count++;
+        lua_rawseti(L, 2, count);
+        lua_pushinteger(L, _from_native_events(evs[i].events));
+        lua_rawseti(L, 3, count);
+    }
+#else
+    n = poll(poller->fds, poller->count, timeout);
+    if(n < 0) {
+        int err = socket_errno;
+        lua_pushinteger(L, 0);
+        if(err == EINTR) {
+            return 1;
+        }
+        lua_pushinteger(L, err);
+        return 2;
+    }
+    for(i=0; i<poller->count && count<n; i++) {
+        struct pollfd *p = &poller->fds[i];
+        if(p->revents == 0) {
+            continue;
+        }
+        if(lua_rawgeti(L, 4, p->fd) == LUA_TNIL) {
+            lua_pop(L, 1);
+            continue;
+        }
+        count++;
+        lua_rawseti(L, 2, count);
+        lua_pushinteger(L, _from_native_events(p->revents));
+        lua_rawseti(L, 3, count);
+    }
+#endif
+    lua_pushinteger(L, count);
+    return 1;
+}
+
+static int
+_poller_count(lua_State *L) {
+    poller_t *poller = _getpoller(L, 1);
+    lua_pushinteger(L, poller->count);
+    return 1;
+}
+
+static int
+_poller_close(lua_State *L) {
+    poller_t *poller = (poller_t*)luaL_checkudata(L, 1, POLLER_METATABLE);
+    if(poller->count < 0) {
+        return 0;
+    }
+    poller->count = -1;
+#ifdef USE_EPOLL
+    if(poller->fd >= 0) {
+        close(poller->fd);
+        poller->fd = -1;
+    }
+#else
+    free(poller->fds);
+    poller->fds = NULL;
+    poller->cap = 0;
+#endif
+    return 0;
+}
+
+static int
+_poller_tostring(lua_State *L) {
+    poller_t *poller = (poller_t*)luaL_checkudata(L, 1, POLLER_METATABLE);
+    lua_pushfstring(L, "poller: %p", poller);
+    return 1;
+}
+
+static const struct luaL_Reg poller_mt[] = {
+    {"__gc", _poller_close},
+    {"__tostring", _poller_tostring},
+    {NULL, NULL}
+};
+
+static const struct luaL_Reg poller_methods[] = {
+    {"add", _poller_add},
+    {"mod", _poller_mod},
+    {"del", _poller_del},
+    {"wait", _poller_wait},
+    {"count", _poller_count},
+    {"close", _poller_close},
+    {NULL, NULL}
+};
+
+/* end */
+
+/* resolver object
+ *
+ * query() puts the host on a queue served by a small thread pool, each
+ * finished lookup writes one byte to a socketpair. the read end is a
+ * socket object (resolver:socket()), so it can be registered in a poller,
+ * poll() then collects the finished lookups without blocking.
+ *
+ * the workers are detached, close() never waits for a getaddrinfo. the
+ * state is shared by the lua object and every worker, the last one to let
+ * go of it frees it and closes the write end.
+ */
+
+typedef struct _resolve_req {
+    struct _resolve_req *next;
+    lua_Integer id;
+    int err;
+    struct addrinfo *res;
+    char host[1];
+} resolve_req_t;
+
+typedef struct _resolver_t {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    resolve_req_t *queue_head;
+    resolve_req_t *queue_tail;
+    resolve_req_t *done_head;
+    resolve_req_t *done_tail;
+    int nthread;    // threads to start
+    int started;    // threads running, started on first query
+    int refs;       // the lua object + running threads
+    int closed;
+    int notify_fd;  // write end of the socketpair
+    lua_Integer id;
+} resolver_t;
+
+static void
+_resolve_req_free(resolve_req_t *req) {
+    if(req->res) {
+        freeaddrinfo(req->res);
+    }
+    free(req);
+}
+
+static void
+_resolve_req_list_free(resolve_req_t *req) {
+    while(req) {
+        resolve_req_t *next = req->next;
+        _resolve_req_free(req);
+        req = next;
+    }
+}
+
+// drop one reference, call with r->lock held. unlocks it
+static void
+_resolver_release(resolver_t *r) {
+    int last = --r->refs == 0;
+    pthread_mutex_unlock(&r->lock);
+    if(!last) {
+        return;
+    }
+    _resolve_req_list_free(r->queue_head);
+    _resolve_req_list_free(r->done_head);
+    close(r->notify_fd);
+    pthread_cond_destroy(&r->cond);
+    pthread_mutex_destroy(&r->lock);
+    free(r);
+}
+
+/*
+ * detached workers can outlive lua_close, which unloads this module and
+ * would leave them running unmapped code. keep the module loaded once a
+ * worker has started.
+ */
+static void
+_resolver_pin_module(void) {
+    static int pinned = 0;
+    Dl_info info;
+    if(pinned) {
+        return;
+    }
+    pinned = 1;
+    if(dladdr((void*)_resolver_pin_module, &info) && info.dli_fname) {
+        (void)dlopen(info.dli_fname, RTLD_NOW | RTLD_NODELETE);
+    }
+}
+
+static void*
+_resolver_thread(void *ud) {
+    resolver_t *r = (resolver_t*)ud;
+    struct addrinfo hints;
+    int flags = 0;
+#ifdef MSG_NOSIGNAL
+    flags = MSG_NOSIGNAL;
+#endif
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    for(;;) {
+        resolve_req_t *req;
+        pthread_mutex_lock(&r->lock);
+        while(!r->closed && r->queue_head == NULL) {
+            pthread_cond_wait(&r->cond, &r->lock);
+        }
+        if(r->closed) {
+            _resolver_release(r);
+            break;
+        }
+        req = r->queue_head;
+        r->queue_head = req->next;
+        if(r->queue_head == NULL) {
+            r->queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&r->lock);
+
+        req->next = NULL;
+        req->err = getaddrinfo(req->host, NULL, &hints, &req->res);
+        if(req->err != 0) {
+            req->res = NULL;
+        }
+
+        pthread_mutex_lock(&r->lock);
+        if(r->closed) {
+            // nobody will poll it
+            pthread_mutex_unlock(&r->lock);
+            _resolve_req_free(req);
+            continue;
+        }
+        if(r->done_tail) {
+            r->done_tail->next = req;
+        } else {
+            r->done_head = req;
+        }
+        r->done_tail = req;
+        pthread_mutex_unlock(&r->lock);
+
+        /*
+         * the result is ignored: the pipe may be full when nobody polls,
+         * one pending byte is enough, and the read end may already be
+         * closed. MSG_NOSIGNAL/SO_NOSIGPIPE keep that from raising SIGPIPE.
+         * the write end itself stays open while this thread holds a ref.
+         */
+        (void)send(r->notify_fd, "", 1, flags);
+    }
+    return NULL;
+}
+
+INLINE static resolver_t*
+_getresolver(lua_State *L, int index) {
+    resolver_t **pr = (resolver_t**)luaL_checkudata(L, index, RESOLVER_METATABLE);
+    if(*pr == NULL) {
+        luaL_error(L, "resolver is closed");
+    }
+    return *pr;
+}
+
+static void
+_setnonblock(int fd) {
+    int flag = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flag | O_NONBLOCK);
+}
+
+/*
+ *   args: [int threads]
+ */
+static int
+_resolver(lua_State *L) {
+    int nthread = (int)luaL_optinteger(L, 1, RESOLVER_DEF_THREADS);
+    resolver_t **pr;
+    resolver_t *r;
+    int fds[2];
+
+    luaL_argcheck(L, nthread > 0 && nthread <= RESOLVER_MAX_THREADS, 1, "invalid thread count");
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        lua_pushnil(L);
+        lua_pushinteger(L, errno);
+        return 2;
+    }
+    _setnonblock(fds[0]);
+    _setnonblock(fds[1]);
+#ifdef SO_NOSIGPIPE
+    {
+        int on = 1;
+        setsockopt(fds[1], SOL_SOCKET, SO_NOSIGPIPE, (void*)&on, sizeof(on));
+    }
+#endif
+
+    pr = (resolver_t**)lua_newuserdata(L, sizeof(resolver_t*));
+    *pr = NULL;
+    r = (resolver_t*)malloc(sizeof(resolver_t));
+    if(r == NULL) {
+        close(fds[0]);
+        close(fds[1]);
+        return luaL_error(L, "resolver: out of memory");
+    }
+    memset(r, 0, sizeof(*r));
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    r->nthread = nthread;
+    r->refs = 1;
+    r->notify_fd = fds[1];
+    *pr = r;
+    luaL_getmetatable(L, RESOLVER_METATABLE);
+    lua_setmetatable(L, -2);
+
+    // the read end lives in the uservalue
+    _setsock(L, fds[0], AF_UNIX, SOCK_STREAM, 0);
+    lua_setuservalue(L, -2);
+    return 1;
+}
+
+/*
+ *   args: string host
+ *   return query id, the result is reported by poll()
+ */
+static int
+_resolver_query(lua_State *L) {
+    resolver_t *r = _getresolver(L, 1);
+    size_t sz;
+    const char *host = luaL_checklstring(L, 2, &sz);
+    resolve_req_t *req;
+
+    if(r->started < r->nthread) {
+        _resolver_pin_module();
+    }
+    while(r->started < r->nthread) {
+        pthread_t thread;
+        // pthread_create returns the error code, it doesn't set errno
+        int err;
+        pthread_mutex_lock(&r->lock);
+        r->refs++;
+        pthread_mutex_unlock(&r->lock);
+        err = pthread_create(&thread, NULL, _resolver_thread, r);
+        if(err != 0) {
+            pthread_mutex_lock(&r->lock);
+            r->refs--;
+            pthread_mutex_unlock(&r->lock);
+            if(r->started == 0) {
+                lua_pushnil(L);
+                lua_pushinteger(L, err);
+                return 2;
+            }
+            r->nthread = r->started;
+            break;
+        }
+        pthread_detach(thread);
+        r->started++;
+    }
+
+    req = (resolve_req_t*)malloc(sizeof(resolve_req_t) + sz);
+    if(req == NULL) {
+        return luaL_error(L, "resolver: out of memory");
+    }
+    memcpy(req->host, host, sz + 1);
+    req->next = NULL;
+    req->err = 0;
+    req->res = NULL;
+    req->id = ++r->id;
+
+    pthread_mutex_lock(&r->lock);
+    if(r->queue_tail) {
+        r->queue_tail->next = req;
+    } else {
+        r->queue_head = req;
+    }
+    r->queue_tail = req;
+    pthread_cond_signal(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+
+    lua_pushinteger(L, req->id);
+    return 1;
+}
+
+/*
+ *   args: table out
+ *   out[i] = {id=, host=, addrs={{family=, addr=}, ...}} or
+ *            {id=, host=, err=gai error code}
+ *   return count of finished queries
+ */
+static int
+_resolver_poll(lua_State *L) {
+    resolver_t *r = _getresolver(L, 1);
+    resolve_req_t *req;
+    char tmp[256];
+    int n = 0;
+    int fd;
+
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_getuservalue(L, 1);
+    fd = ((socket_t*)lua_touserdata(L, -1))->fd;
+    lua_pop(L, 1);
+    while(read(fd, tmp, sizeof(tmp)) > 0) {
+    }
+
+    pthread_mutex_lock(&r->lock);
+    req = r->done_head;
+    r->done_head = NULL;
+    r->done_tail = NULL;
+    pthread_mutex_unlock(&r->lock);
+
+    while(req) {
+        resolve_req_t *next = req->next;
+        lua_createtable(L, 0, 3);
+        lua_pushinteger(L, req->id);
+        lua_setfield(L, -2, "id");
+        lua_pushstring(L, req->host);
+        lua_setfield(L, -2, "host");
+        if(req->err != 0) {
+            lua_pushinteger(L, req->err);
+            lua_setfield(L, -2, "err");
+        } else {
+            _push_addrinfo(L, req->res);
+            lua_setfield(L, -2, "addrs");
+        }
+        lua_rawseti(L, 2, ++n);
+        _resolve_req_free(req);
+        req = next;
+    }
+    lua_pushinteger(L, n);
+    return 1;
+}
+
+/*
+ *   the socket that becomes readable when poll() has results
+ */
+static int
+_resolver_socket(lua_State *L) {
+    _getresolver(L, 1);
+    lua_getuservalue(L, 1);
+    return 1;
+}
+
+// doesn't wait: lookups still running finish in the background and are dropped
+static int
+_resolver_close(lua_State *L) {
+    resolver_t **pr = (resolver_t**)luaL_checkudata(L, 1, RESOLVER_METATABLE);
+    resolver_t *r = *pr;
+    if(r == NULL) {
+        return 0;
+    }
+    *pr = NULL;
+
+    pthread_mutex_lock(&r->lock);
+    r->closed = 1;
+    pthread_cond_broadcast(&r->cond);
+    _resolver_release(r);
+    return 0;
+}
+
+static int
+_resolver_tostring(lua_State *L) {
+    resolver_t **pr = (resolver_t**)luaL_checkudata(L, 1, RESOLVER_METATABLE);
+    lua_pushfstring(L, "resolver: %p", (void*)pr);
+    return 1;
+}
+
+static const struct luaL_Reg resolver_mt[] = {
+    {"__gc", _resolver_close},
+    {"__tostring", _resolver_tostring},
+    {NULL, NULL}
+};
+
+static const struct luaL_Reg resolver_methods[] = {
+    {"query", _resolver_query},
+    {"poll", _resolver_poll},
+    {"socket", _resolver_socket},
+    {"close", _resolver_close},
+    {NULL, NULL}
+};
+
+#endif // _WIN32
+
+/* end */
+
 // +construct socket metatable
 static const struct luaL_Reg socket_mt[] = {
     {"__gc", _sock_close},
@@ -731,7 +1867,9 @@ static const struct luaL_Reg socket_methods[] = {
     {"check_async_connect", _sock_check_async_connect},
 
     {"recv", _sock_recv},
+    {"recv_into", _sock_recv_into},
     {"send", _sock_send},
+    {"sendv", _sock_sendv},
 
     {"recvfrom", _sock_recvfrom},
     {"sendto", _sock_sendto},
@@ -741,6 +1879,7 @@ static const struct luaL_Reg socket_methods[] = {
     {"accept", _sock_accept},
 
     {"fileno", _sock_fileno},
+    {"stat", _sock_stat},
     {"getpeername", _sock_getpeername},
     {"getsockname", _sock_getsockname},
 
@@ -757,6 +1896,16 @@ static const struct luaL_Reg socket_module_methods[] = {
     {"strerror", _lstrerror},
     {"gai_strerror", _lgai_strerror},
     {"normalize_ip", _normalize_ip},
+    {"gettime", _gettime},
+    {"gettime_us", _gettime_us},
+#ifndef _WIN32
+    {"poller", _poller},
+    {"fork", _fork},
+    {"getpid", _getpid},
+    {"socketpair", _socketpair},
+    {"waitpid", _waitpid},
+    {"resolver", _resolver},
+#endif
     {NULL, NULL}
 };
 
@@ -795,6 +1944,24 @@ LUALIB_API int luaopen_socket_c(lua_State *L) {
         lua_setfield(L, -2, "__index");
     }
     lua_pop(L, 1);
+
+#ifndef _WIN32
+    if(luaL_newmetatable(L, POLLER_METATABLE)) {
+        luaL_setfuncs(L, poller_mt, 0);
+
+        luaL_newlib(L, poller_methods);
+        lua_setfield(L, -2, "__index");
+    }
+    lua_pop(L, 1);
+
+    if(luaL_newmetatable(L, RESOLVER_METATABLE)) {
+        luaL_setfuncs(L, resolver_mt, 0);
+
+        luaL_newlib(L, resolver_methods);
+        lua_setfield(L, -2, "__index");
+    }
+    lua_pop(L, 1);
+#endif
     // +end
 
     luaL_newlib(L, socket_module_methods);
@@ -834,6 +2001,30 @@ LUALIB_API int luaopen_socket_c(lua_State *L) {
     ADD_CONSTANT(L, SO_LINGER_SEC);
 #endif
 
+    // tcp opt, level IPPROTO_TCP
+    ADD_CONSTANT(L, TCP_NODELAY);
+#ifdef TCP_QUICKACK
+    ADD_CONSTANT(L, TCP_QUICKACK);
+#endif
+#ifdef TCP_KEEPIDLE
+    ADD_CONSTANT(L, TCP_KEEPIDLE);
+#elif defined(TCP_KEEPALIVE)
+    // macos names TCP_KEEPIDLE as TCP_KEEPALIVE
+    _add_unsigned_constant(L, "TCP_KEEPIDLE", TCP_KEEPALIVE);
+#endif
+#ifdef TCP_KEEPINTVL
+    ADD_CONSTANT(L, TCP_KEEPINTVL);
+#endif
+#ifdef TCP_KEEPCNT
+    ADD_CONSTANT(L, TCP_KEEPCNT);
+#endif
+#ifdef TCP_USER_TIMEOUT
+    ADD_CONSTANT(L, TCP_USER_TIMEOUT);
+#endif
+#ifdef TCP_NOTSENT_LOWAT
+    ADD_CONSTANT(L, TCP_NOTSENT_LOWAT);
+#endif
+
     // errno
     ADD_CONSTANT(L, EINTR);
     ADD_CONSTANT(L, EAGAIN);
@@ -841,6 +2032,11 @@ LUALIB_API int luaopen_socket_c(lua_State *L) {
     ADD_CONSTANT(L, ECONNREFUSED);
     ADD_CONSTANT(L, EISCONN);
 
+    // poller events
+    ADD_CONSTANT(L, EVENT_READ);
+    ADD_CONSTANT(L, EVENT_WRITE);
+    ADD_CONSTANT(L, EVENT_ERROR);
+
     return 1;
 }
 
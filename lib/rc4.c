@@ -37,6 +37,7 @@
  */
 
 #include <stdint.h>
+#include <string.h>
 #include "rc4.h"
 
 static __inline void
@@ -72,32 +73,87 @@ librc4_init(struct rc4_state *const state, const uint8_t *key, int keylen)
   }
 }
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RC4_SSE2
+#endif
+
+/* keystream bytes generated per round before xor */
+#define RC4_BLOCK 64
+
+static __inline void
+xor_block(uint8_t *out, const uint8_t *in, const uint8_t *ks)
+{
+  int k;
+#if defined(__AVX2__)
+  for (k = 0; k < RC4_BLOCK; k += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(in + k));
+    __m256i s = _mm256_loadu_si256((const __m256i *)(ks + k));
+    _mm256_storeu_si256((__m256i *)(out + k), _mm256_xor_si256(v, s));
+  }
+#elif defined(RC4_SSE2)
+  for (k = 0; k < RC4_BLOCK; k += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(in + k));
+    __m128i s = _mm_loadu_si128((const __m128i *)(ks + k));
+    _mm_storeu_si128((__m128i *)(out + k), _mm_xor_si128(v, s));
+  }
+#else
+  for (k = 0; k < RC4_BLOCK; k += 8) {
+    uint64_t v, s;
+    memcpy(&v, in + k, 8);
+    memcpy(&s, ks + k, 8);
+    v ^= s;
+    memcpy(out + k, &v, 8);
+  }
+#endif
+}
+
 /*
  * Encrypt some data using the supplied RC4 state buffer.
  * The input and output buffers may be the same buffer.
  * Since RC4 is a stream cypher, this function is used
  * for both encryption and decryption.
+ *
+ * The indices stay in locals for the whole call, keystream is produced
+ * RC4_BLOCK bytes at a time and xored word/vector wide.
  */
 void
 librc4_crypt(struct rc4_state *const state,
   const uint8_t *inbuf, uint8_t *outbuf, int buflen)
 {
-  int i;
-  uint8_t j;
-
-  for (i = 0; i < buflen; i++) {
+  uint8_t *const perm = state->perm;
+  uint8_t i = state->index1;
+  uint8_t j = state->index2;
+  uint8_t a, b;
+  uint8_t ks[RC4_BLOCK];
+  int pos = 0;
+  int k;
 
-    /* Update modification indicies */
-    state->index1++;
-    state->index2 += state->perm[state->index1];
-
-    /* Modify permutation */
-    swap_bytes(&state->perm[state->index1],
-        &state->perm[state->index2]);
+  for (; buflen - pos >= RC4_BLOCK; pos += RC4_BLOCK) {
+    for (k = 0; k < RC4_BLOCK; k++) {
+      i++;
+      a = perm[i];
+      j += a;
+      b = perm[j];
+      perm[i] = b;
+      perm[j] = a;
+      ks[k] = perm[(uint8_t)(a + b)];
+    }
+    xor_block(outbuf + pos, inbuf + pos, ks);
+  }
 
-    /* Encrypt/decrypt next byte */
-    j = state->perm[state->index1] + state->perm[state->index2];
-    outbuf[i] = inbuf[i] ^ state->perm[j];
+  for (; pos < buflen; pos++) {
+    i++;
+    a = perm[i];
+    j += a;
+    b = perm[j];
+    perm[i] = b;
+    perm[j] = a;
+    outbuf[pos] = inbuf[pos] ^ perm[(uint8_t)(a + b)];
   }
-}
 
+  state->index1 = i;
+  state->index2 = j;
+}
@@ -1,6 +1,12 @@
 local sproto = require "sproto.sproto"
 local conn = require "conn"
+local stats = require "stats"
+local socket = require "socket.c"
 
+local gettime_us = socket.gettime_us
+
+-- 设置了超时时, update检查超时请求的间隔(毫秒)
+local TIMEOUT_CHECK_INTERVAL = 100
 
 local mt = {}
 
@@ -23,6 +29,17 @@ local function new(client_pbin, server_pbin)
 
         v_client = client,
         v_client_request = client_request,
+
+        -- 请求超时, 见 mt:set_timeout
+        v_timeout = false,
+        v_next_timeout_check = 0,
+        -- 最早的可能还没有返回的session, session按发送顺序递增
+        v_oldest_session = 0,
+
+        -- 协议名 -> {calls, responses, timeouts, rtt_us}
+        v_rtt_stat = {},
+        -- 超时后才收到的回应
+        v_late_responses = 0,
     }
 
     return setmetatable(raw, {__index = mt})
@@ -32,6 +49,7 @@ end
 
 function mt:connect(host, port)
     self.v_request_session = {}
+    self.v_oldest_session = self.v_session_index
     local obj, errcode = conn.connect_host(host, port)
     if not obj then
         return false, errcode
@@ -42,6 +60,37 @@ function mt:connect(host, port)
 end
 
 
+local function rtt_stat(self, name)
+    local st = self.v_rtt_stat[name]
+    if not st then
+        st = {
+            calls = 0,
+            responses = 0,
+            timeouts = 0,
+            rtt_us = stats.histogram(),
+        }
+        self.v_rtt_stat[name] = st
+    end
+    return st
+end
+
+
+local function call_handle(session_item, ...)
+    local handle = session_item.handle
+    local tt  = type(handle)
+    if tt == "function" then
+        handle(...)
+    elseif tt == "thread" then
+        local success, err = coroutine.resume(handle, ...)
+        if not success then
+            error(err)
+        end
+    else
+        error("error handle type:"..tt.." from msg:"..tostring(session_item.name))
+    end
+end
+
+
 local function dispatch(self, resp)
     local client = self.v_client
     local _type, v1, v2, v3 = client:dispatch(resp)
@@ -49,20 +98,18 @@ local function dispatch(self, resp)
     if _type == "RESPONSE" then
         local session, response = v1, v2
         local session_item = self.v_request_session[session]
-        local handle = session_item.handle
-        local tt  = type(handle)
-        if tt == "function" then
-            handle(response)
-        elseif tt == "thread" then
-            local success, err = coroutine.resume(handle, response)
-            if not success then
-                error(err)
-            end
-        else
-            error("error handle type:"..tt.." from msg:"..tostring(session_item.name))
+        if not session_item then
+            -- 已经超时的请求
+            self.v_late_responses = self.v_late_responses + 1
+            return
         end
         self.v_request_session[session] = nil
 
+        local st = rtt_stat(self, session_item.name)
+        st.responses = st.responses + 1
+        stats.observe(st.rtt_us, gettime_us() - session_item.time)
+        call_handle(session_item, response)
+
     elseif _type == "REQUEST" then
         local name, request, response = v1, v2, v3
         local handle = self.v_response_handle[name]
@@ -77,7 +124,71 @@ local function dispatch(self, resp)
 end
 
 
+--[[
+移除发出超过timeout毫秒还没有回应的请求, 以 nil, "timeout" 调用它们的回调
+(或者唤醒等待的coroutine)。之后收到的回应会被丢弃。
+out: 可选参数, 填入超时的 {session = , name = , elapsed_us = }
+返回超时的请求数
+]]
+function mt:check_timeout(timeout, out)
+    local sessions = self.v_request_session
+    local now = gettime_us()
+    local timeout_us = timeout * 1000
+    local last = self.v_session_index
+    local i = self.v_oldest_session
+    local count = 0
+
+    while i < last do
+        local session_item = sessions[i]
+        if session_item then
+            local elapsed = now - session_item.time
+            if elapsed < timeout_us then
+                break
+            end
+            sessions[i] = nil
+
+            local st = rtt_stat(self, session_item.name)
+            st.timeouts = st.timeouts + 1
+            count = count + 1
+            if out then
+                out[count] = {session = i, name = session_item.name, elapsed_us = elapsed}
+            end
+            call_handle(session_item, nil, "timeout")
+        end
+        i = i + 1
+    end
+    self.v_oldest_session = i
+    return count
+end
+
+
+-- update时自动检查超时的请求, 见check_timeout; timeout为nil时关闭
+function mt:set_timeout(timeout)
+    self.v_timeout = timeout or false
+end
+
+
+--[[
+按协议名返回请求统计的快照:
+    {[name] = {calls = , responses = , timeouts = , rtt_us = }}
+    rtt_us: 往返耗时的直方图(微秒), 见stats.lua
+第二个返回值为超时后才收到的回应数
+]]
+function mt:rtt_stat()
+    return stats.copy(self.v_rtt_stat), self.v_late_responses
+end
+
+
 function mt:update()
+    local timeout = self.v_timeout
+    if timeout then
+        local now = socket.gettime()
+        if now >= self.v_next_timeout_check then
+            self.v_next_timeout_check = now + TIMEOUT_CHECK_INTERVAL
+            self:check_timeout(timeout)
+        end
+    end
+
     local success, err, status = self.v_conn:update()
 
     if success then
@@ -88,6 +199,7 @@ function mt:update()
 
         for i=1,count do
             local resp = out[i]
+            out[i] = nil
             dispatch(self, resp)
         end
     end
@@ -110,9 +222,13 @@ function mt:call(name, t, cb)
     local session_item = {
         name = name,
         handle = false,
+        time = gettime_us(),
     }
     self.v_request_session[session_index] = session_item
 
+    local st = rtt_stat(self, name)
+    st.calls = st.calls + 1
+
     if cb then
         session_item.handle = cb
         request(self, name, t, session_index)
@@ -2,80 +2,30 @@ local conn = require "conn"
 local crypt = require "crypt"
 local rc4 = require "rc4.c"
 local buffer_queue = require "buffer_queue"
+local stats = require "stats"
+local socket = require "socket.c"
 
-local pack_data = buffer_queue.pack_data
+local gettime_us = socket.gettime_us
 
 
-local CACHE_MAX_COUNT = 100
+local DEF_CACHE_MAX_BYTES = 64*1024
 local DEF_MSG_HEADER_LEN = 2
 local DEF_MSG_ENDIAN = "little"
 
 local mt = {}
-local cache_mt = {}
 
 
 -------------- for test ---------------
 local VERBOSE = true
-local log = VERBOSE and print or 
-    function(...)
-    end
+local function nolog(...)
+end
+local log = VERBOSE and print or nolog
 
 -------------- cache ------------------
+-- 重连补发缓存: 最近发送的密文, 按字节限制大小.
+-- 缓存覆盖的区间是 [v_sendnumber - cache:size(), v_sendnumber)
 local function cache_create()
-    local raw = {
-        size = 0,
-
-        top = 0,
-        cache = {},
-    }
-    return setmetatable(raw, {__index = cache_mt})
-end
-
-function cache_mt:insert(data)
-    local cache = self.cache
-    self.top = self.top + 1
-    cache[self.top] = data
-    self.size = self.size + #data
-    local remove_cache_value = cache[self.top-CACHE_MAX_COUNT]
-    cache[self.top-CACHE_MAX_COUNT] = nil  -- 只缓存最近CACHE_MAX_COUNT个包
-    if remove_cache_value then
-        self.size = self.size - #remove_cache_value
-    end
-end
-
-function cache_mt:get(nbytes)
-    if self.size < nbytes then
-        return false
-    end
-
-    local cache = self.cache
-    local i = self.top
-    local count = 0
-    local ret = {}
-    while count<nbytes do
-        local v = cache[i]
-        local len = #v
-        local n = len
-        local vv = v
-        if count + len > nbytes then
-            local sub_n = nbytes - count
-            local pos = len-sub_n
-            local sub_v = string.sub(v, pos+1)
-            n = sub_n
-            vv = sub_v
-        end
-        table.insert(ret, 1, vv)
-        count = count + n
-        i = i-1
-    end
-
-    return table.concat(ret)
-end
-
-
-function cache_mt:clear()
-    self.size = 0
-    self.top = 0
+    return buffer_queue.create()
 end
 
 local function dummy(...)
@@ -89,6 +39,37 @@ local function dispose_error(state_self, _success, _err, _status)
     return success, err, status
 end
 
+-- 加密data(字符串或buffer)到缓存, 再把这段密文拷贝到连接的发送队列.
+-- data为buffer时会被取空
+local function send_crypt(self, data)
+    local cache = self.v_cache
+    local n = self.v_rc4_c2s:crypt(data, cache)
+    self.v_sock:send_tail(cache, n)
+    cache:trim(self.v_cache_max)
+
+    self.v_sendnumber = self.v_sendnumber + n
+end
+
+-- 把消息(字符串或字符串列表)分帧追加到buf尾部, 返回追加的字节数
+local function push_msgs(buf, data, header_len, endian)
+    if type(data) == "table" then
+        return buf:push_blocks(data, header_len, endian)
+    end
+    local from = buf:size()
+    buf:push_block(data, header_len, endian)
+    return buf:size() - from
+end
+
+-- 消息直接分帧到缓存尾部再原地加密, 不生成打包后的明文字符串.
+-- 返回这段密文的字节数, 调用者负责发送和trim
+local function cache_msgs(self, data, header_len, endian)
+    local cache = self.v_cache
+    local n = push_msgs(cache, data, header_len, endian)
+    self.v_rc4_c2s:crypt_buffer(cache, cache:size() - n, n)
+    self.v_sendnumber = self.v_sendnumber + n
+    return n
+end
+
 -------------- state ------------------
 
 local state = {
@@ -97,6 +78,7 @@ local state = {
         request = false,
         dispatch = false,
         send = false,
+        send_msg = false,
         dispose = false,
     },
 
@@ -105,6 +87,7 @@ local state = {
         request = false,
         dispatch = false,
         send = false,
+        send_msg = false,
         dispose = false,
     },
 
@@ -113,30 +96,35 @@ local state = {
         request = false,
         dispatch = false,
         send = false,
+        send_msg = false,
         dispose = false,
     },
 
     reconnect_error = {
         name = "reconnect_error",
         send = dummy,
+        send_msg = dummy,
         dispose = dispose_error,
     },
 
     reconnect_match_error = {
         name = "reconnect_match_error",
         send = dummy, 
+        send_msg = dummy,
         dispose = dispose_error,
     },
 
     reconnect_cache_error = {
         name = "reconnect_cache_error",
         send = dummy, 
+        send_msg = dummy,
         dispose = dispose_error,
     },
 
     close = {
         name = "close",
         send = dummy,
+        send_msg = dummy,
         dispose = false,
     },
 }
@@ -151,7 +139,6 @@ local function switch_state(self, s, ...)
     end
 end
 
-local out = {}
 
 -------------- new connect state ------------------
 function state.newconnect.request(self, target_server, flag)
@@ -167,17 +154,22 @@ function state.newconnect.request(self, target_server, flag)
         crypt.base64encode(crypt.dhexchange(clientkey)),
         target_server, flag)
 
-    data = pack_data(data, 2, "big")
-    self.v_sock:send(data)
+    self.v_sock:send_msg(data, 2, "big")
     self.v_clientkey = clientkey
     log("request:", data)
-    self.v_send_buf_top = 0
 end
 
 
+-- 握手完成前只缓存明文, 拿到密钥后一次性加密
 function state.newconnect.send(self, data)
-    self.v_send_buf_top = self.v_send_buf_top + 1
-    self.v_send_buf[self.v_send_buf_top] = data
+    self.v_pending:push(data)
+    self.v_handshake_bytes = self.v_handshake_bytes + #data
+end
+
+
+function state.newconnect.send_msg(self, data, header_len, endian)
+    local n = push_msgs(self.v_pending, data, header_len, endian)
+    self.v_handshake_bytes = self.v_handshake_bytes + n
 end
 
 
@@ -205,13 +197,13 @@ function state.newconnect.dispatch(self)
     self.v_rc4_s2c = rc4.rc4(rc4_key)
 
     switch_state(self, "forward")
+    stats.observe(self.v_stat.handshake_us, gettime_us() - self.v_handshake_start)
 
-    -- 发送在新连接建立中间缓存的数据包
-    for i=1,self.v_send_buf_top do
-        self:send(self.v_send_buf[i])
+    -- 发送在新连接建立中间缓存的数据, 加密时直接从pending取出
+    local pending = self.v_pending
+    if pending:size() > 0 then
+        send_crypt(self, pending)
     end
-    self.v_send_buf_top = 0
-    self.v_send_buf = {}
 end
 
 
@@ -240,22 +232,25 @@ function state.reconnect.request(self)
 
     local hmac = crypt.base64encode(crypt.hmac64_md5(crypt.hashkey(content), self.v_secret))
     local data = string.format("%s%s\n", content, hmac)
-    data = pack_data(data, 2, "big")
-
     log("request:", data)
 
-    self.v_sock:send(data)
+    self.v_sock:send_msg(data, 2, "big")
 end
 
 
 -- 在断线重连期间，仅仅是把数据插入到cache中
 function state.reconnect.send(self, data)
-    local rc4_c2s = self.v_rc4_c2s
     local cache = self.v_cache
-    data = rc4_c2s:crypt(data)
+    local n = self.v_rc4_c2s:crypt(data, cache)
+    cache:trim(self.v_cache_max)
+
+    self.v_sendnumber = self.v_sendnumber + n
+end
+
 
-    self.v_sendnumber = self.v_sendnumber + #data
-    cache:insert(data)
+function state.reconnect.send_msg(self, data, header_len, endian)
+    cache_msgs(self, data, header_len, endian)
+    self.v_cache:trim(self.v_cache_max)
 end
 
 
@@ -272,10 +267,12 @@ function state.reconnect.dispatch(self)
 
     local cb = self.v_reconnect_cb
     self.v_reconnect_cb = nil
+    local st = self.v_stat
 
     -- 重连失败
     if msg ~= "200" then
         log("msg:", msg)
+        st.reconnect_fail = st.reconnect_fail + 1
         if cb then cb(false) end
         switch_state(self, "reconnect_error")
         return
@@ -283,29 +280,31 @@ function state.reconnect.dispatch(self)
 
     -- 服务器接受的数据要比客户端记录的发送的数据还要多
     if recv > sendnumber then
+        st.reconnect_fail = st.reconnect_fail + 1
         if cb then cb(false) end
         switch_state(self, "reconnect_match_error")
         return
     end
 
     -- 需要补发的数据
-    local nbytes = 0
     if recv < sendnumber then
-        nbytes = sendnumber - recv
-        local data = self.v_cache:get(nbytes)
+        local nbytes = sendnumber - recv
+        local cache = self.v_cache
         -- 缓存的数据不足
-        if not data then
+        if cache:size() < nbytes then
+            st.reconnect_fail = st.reconnect_fail + 1
             if cb then cb(false) end
             switch_state(self, "reconnect_cache_error")
             return
         end
 
-        -- 发送补发数据
-        assert(#data == nbytes)
-        self.v_sock:send(data)
+        -- 发送补发数据, 直接从缓存尾部拷贝到发送队列
+        self.v_sock:send_tail(cache, nbytes)
+        st.replay_bytes = st.replay_bytes + nbytes
     end
 
     -- 重连成功
+    stats.observe(st.reconnect_us, gettime_us() - self.v_reconnect_start)
     if cb then cb(true) end
     switch_state(self, "forward")
 end
@@ -322,29 +321,20 @@ end
 
 --------------  forward ------------------
 function state.forward.dispatch(self)
-    local recv_buf = self.v_recv_buf
-    local rc4_s2c = self.v_rc4_s2c
-    local sock = self.v_sock
-    local count = sock:recv(out)
-
-    for i=1,count do
-        local v = out[i]
-        self.v_recvnumber = self.v_recvnumber + #v
-        v = rc4_s2c:crypt(v)
-        recv_buf:push(v)
-    end
+    -- 把连接上收到的数据直接解密到接收缓冲区
+    local n = self.v_rc4_s2c:crypt(self.v_sock:recv_buffer(), self.v_recv_buf)
+    self.v_recvnumber = self.v_recvnumber + n
 end
 
 function state.forward.send(self, data)
-    local sock = self.v_sock
-    local rc4_c2s = self.v_rc4_c2s
-    local cache = self.v_cache
-    data = rc4_c2s:crypt(data)
-
-    sock:send(data)
+    send_crypt(self, data)
+end
 
-    self.v_sendnumber = self.v_sendnumber + #data
-    cache:insert(data)
+function state.forward.send_msg(self, data, header_len, endian)
+    local cache = self.v_cache
+    local n = cache_msgs(self, data, header_len, endian)
+    self.v_sock:send_tail(cache, n)
+    cache:trim(self.v_cache_max)
 end
 
 
@@ -367,7 +357,8 @@ function state.close.dispose(state_self, success, err, status)
 end
 
 
-local function connect(host, port, targetserver, flag)
+-- options: 可选参数, socket选项, 见conn.set_options, 重连时同样生效
+local function connect(host, port, targetserver, flag, options)
     local raw = {
         v_state = false,
         v_sock = false,
@@ -383,14 +374,27 @@ local function connect(host, port, targetserver, flag)
         v_recvnumber = 0,
         v_reconnect_index = 0,
         v_cache = cache_create(),
+        v_cache_max = DEF_CACHE_MAX_BYTES,
 
-        v_send_buf = {},
-        v_send_buf_top = 0,
+        v_pending = buffer_queue.create(),
+        v_handshake_bytes = 0,
 
         v_recv_buf = buffer_queue.create(),
+
+        v_stat = {
+            msgs_in = 0,
+            msgs_out = 0,
+            reconnects = 0,
+            reconnect_fail = 0,
+            replay_bytes = 0,
+            handshake_us = stats.histogram(),
+            reconnect_us = stats.histogram(),
+        },
+        v_handshake_start = gettime_us(),
+        v_reconnect_start = 0,
     }
 
-    local sock, err = conn.connect_host(host, port)
+    local sock, err = conn.connect_host(host, port, options)
     if not sock then
         return nil, err
     end
@@ -420,6 +424,8 @@ function mt:reconnect(cb)
     end
 
     self.v_reconnect_cb = cb
+    self.v_reconnect_start = gettime_us()
+    self.v_stat.reconnects = self.v_stat.reconnects + 1
     switch_state(self, "reconnect")
     return true
 end
@@ -444,12 +450,14 @@ status: string类型 当前sconn所在的状态，状态只能是:
     "reconnect": 断线重连状态
     "connect_break": 断开连接状态
     "close": 关闭状态
+
+events: 可选参数, 同conn.update
 ]]
 
-function mt:update()
+function mt:update(events)
     local sock = self.v_sock
     local state = self.v_state
-    local success, err, status = sock:update()
+    local success, err, status = sock:update(events)
     local dispatch = state.dispatch
     if success and dispatch then
         dispatch(self)
@@ -466,6 +474,69 @@ function mt:update()
 end
 
 
+-- 重连补发缓存的字节数上限, 断线期间未被服务器确认的数据超过这个值时重连失败
+function mt:set_cache_size(nbytes)
+    assert(nbytes >= 0)
+    self.v_cache_max = nbytes
+    self.v_cache:trim(nbytes)
+end
+
+
+-- 握手期间排队等待发送的字节数(明文)
+function mt:handshake_queued()
+    return self.v_handshake_bytes
+end
+
+
+-- 见conn.set_options
+function mt:set_options(options)
+    return self.v_sock:set_options(options)
+end
+
+
+-- 见conn.set_read_budget
+function mt:set_read_budget(mode, n)
+    self.v_sock:set_read_budget(mode, n)
+end
+
+
+function mt:read_budget_stat()
+    return self.v_sock:read_budget_stat()
+end
+
+
+--[[
+返回连接统计的快照, 字段同conn.stat, 收发的字节和系统调用是密文连接上的计数,
+消息数是sconn收发的消息, 另外有:
+    handshake_us: 从创建到握手完成的耗时直方图(微秒), 包括建立连接
+    reconnects: 发起重连的次数
+    reconnect_fail: 服务器拒绝重连或补发数据不足的次数
+    reconnect_us: 重连成功的耗时直方图(微秒)
+    replay_bytes: 重连后补发的字节数
+    cache_bytes: 当前补发缓存的字节数
+]]
+function mt:stat()
+    local st = self.v_sock:stat()
+    stats.merge(st, self.v_stat)
+    st.msgs_in = self.v_stat.msgs_in
+    st.msgs_out = self.v_stat.msgs_out
+    st.recv_queue = st.recv_queue + self.v_recv_buf:size()
+    st.cache_bytes = self.v_cache:size()
+    return st
+end
+
+
+-- poller:wait返回的对象为sconn自身
+function mt:attach_poller(poller)
+    return self.v_sock:attach_poller(poller, self)
+end
+
+
+function mt:detach_poller()
+    self.v_sock:detach_poller()
+end
+
+
 function mt:send(data)
     local _send = self.v_state.send
     _send(self, data)
@@ -475,12 +546,28 @@ end
 
 
 function mt:send_msg(data, header_len, endian)
-    local _send = self.v_state.send
+    local _send_msg = self.v_state.send_msg
     header_len = header_len or DEF_MSG_HEADER_LEN
     endian = endian or DEF_MSG_ENDIAN
 
-    data = pack_data(data, header_len, endian)
-    _send(self, data)
+    _send_msg(self, data, header_len, endian)
+    local st = self.v_stat
+    st.msgs_out = st.msgs_out + 1
+    return true
+end
+
+
+-- 多个消息一次分帧到缓冲区, 只做一次加密和缓存
+function mt:send_msgs(list, header_len, endian)
+    local _send_msg = self.v_state.send_msg
+    header_len = header_len or DEF_MSG_HEADER_LEN
+    endian = endian or DEF_MSG_ENDIAN
+
+    if #list > 0 then
+        _send_msg(self, list, header_len, endian)
+        local st = self.v_stat
+        st.msgs_out = st.msgs_out + #list
+    end
     return true
 end
 
@@ -492,23 +579,33 @@ end
 
 
 
-function mt:recv_msg(out_msg, header_len, endian)
+function mt:recv_msg(out_msg, header_len, endian, max)
     header_len = header_len or DEF_MSG_HEADER_LEN
     endian = endian or DEF_MSG_ENDIAN
 
     local recv_buf = self.v_recv_buf
-    return recv_buf:pop_all_block(out_msg, header_len, endian)
+    local count = recv_buf:pop_all_block(out_msg, header_len, endian, max)
+    local st = self.v_stat
+    st.msgs_in = st.msgs_in + count
+    return count
 end
 
 
 function mt:close()
     self.v_sock:close()
     self.v_recv_buf:clear()
+    self.v_pending:clear()
     switch_state(self, "close")
 end
 
+-- 是否打印握手和状态切换的日志
+local function set_verbose(verbose)
+    log = verbose and print or nolog
+end
+
 return {
     connect_host = connect,
+    set_verbose = set_verbose,
 }
 
 
@@ -11,18 +11,37 @@ local OK = 0
 local EINTR = socket.EINTR
 local EAGAIN = socket.EAGAIN
 
-local function new(host, port)
+local EVENT_READ = socket.EVENT_READ
+local EVENT_WRITE = socket.EVENT_WRITE
+local EVENT_ERROR = socket.EVENT_ERROR
+
+local DEF_MAX_SESSION = 1024
+
+--[[
+reuseport: 可选参数, 为true时设置SO_REUSEPORT, 多个进程可以监听同一个端口
+]]
+local function new(host, port, reuseport)
     if port==nil and type(host)=="number" then
         port =  host
         host = "127.0.0.1"
     end
 
     local self = {
-        v_max_accept_count = 8,
+        v_max_session = DEF_MAX_SESSION,
         v_session_idx = 0,
+        -- session数组, session.v_pos为它在数组中的下标, 删除时与末尾交换
         v_session = {},
-        __replace_session = {},
         v_sock = false,
+        v_poller = false,
+        v_listening = false,
+        v_ready = {},
+        v_ready_events = {},
+        v_stat = {
+            accept = 0,
+            close = 0,
+            recv_bytes = 0,
+            send_bytes = 0,
+        },
         v_handle = {
             accept = false,
             recv   = false,
@@ -41,6 +60,16 @@ local function new(host, port)
         return false, errcode
     end
 
+    if reuseport then
+        if not socket.SO_REUSEPORT then
+            return false, "SO_REUSEPORT not supported"
+        end
+        local ok, errcode = sock:setsockopt(socket.SOL_SOCKET, socket.SO_REUSEPORT, 1)
+        if not ok then
+            return false, errcode
+        end
+    end
+
     local errcode = sock:bind(host, port)
     if errcode ~= 0 then
         return false, errcode
@@ -49,6 +78,14 @@ local function new(host, port)
     sock:listen()
     sock:setblocking(false)
     self.v_sock = sock
+
+    -- 没有poller的平台退化为每帧轮询所有session
+    if socket.poller then
+        local poller = assert(socket.poller())
+        poller:add(sock, EVENT_READ)
+        self.v_poller = poller
+        self.v_listening = true
+    end
     return setmetatable(self, mt)
 end
 
@@ -66,21 +103,119 @@ local function on_handle(self, type, ...)
 end
 
 
+-- session数达到上限时不再关注监听socket, 连接留在backlog里
+local function sync_listen(self)
+    local poller = self.v_poller
+    if not poller then
+        return
+    end
+
+    local max_session = self.v_max_session
+    local listen = not max_session or #self.v_session < max_session
+    if listen ~= self.v_listening then
+        if listen then
+            poller:add(self.v_sock, EVENT_READ)
+        else
+            poller:del(self.v_sock)
+        end
+        self.v_listening = listen
+    end
+end
+
+
+--[[
+max_session: session数上限, 为false时不限制. 默认为DEF_MAX_SESSION
+]]
+function mt:set_max_session(max_session)
+    self.v_max_session = max_session
+    sync_listen(self)
+end
+
+
+function mt:session_count()
+    return #self.v_session
+end
+
+
+--[[
+返回统计:
+    sessions: 当前session数
+    accept, close: 累计建立/关闭的session数
+    recv_bytes, send_bytes: 累计收发字节数
+]]
+function mt:stat()
+    local stat = self.v_stat
+    return {
+        sessions = #self.v_session,
+        accept = stat.accept,
+        close = stat.close,
+        recv_bytes = stat.recv_bytes,
+        send_bytes = stat.send_bytes,
+    }
+end
+
+
 local function new_session(self, csock)
     self.v_session_idx = self.v_session_idx + 1
+    local session_list = self.v_session
     local session = {
         o_idx      = self.v_session_idx,
+        v_pos      = #session_list + 1,
         v_server   = self,
         v_csock    = csock,
         v_recv_buf = buffer_queue.create(),
         v_send_buf = buffer_queue.create(),
+        v_poll_events = EVENT_READ,
     }
 
     setmetatable(session, session_mt)
-    table.insert(self.v_session, session)
+    session_list[session.v_pos] = session
+    self.v_stat.accept = self.v_stat.accept + 1
+    local poller = self.v_poller
+    if poller then
+        poller:add(csock, EVENT_READ, session)
+    end
     return session
 end
 
+
+local function sync_poll(session)
+    local poller = session.v_server.v_poller
+    if not poller or not session.v_csock then
+        return
+    end
+
+    local events = EVENT_READ
+    if session.v_send_buf:size() > 0 then
+        events = EVENT_READ | EVENT_WRITE
+    end
+    if events ~= session.v_poll_events then
+        poller:mod(session.v_csock, events)
+        session.v_poll_events = events
+    end
+end
+
+
+local function close_session(self, session, err)
+    on_handle(self, "error", session, err)
+    local csock = session.v_csock
+    local poller = self.v_poller
+    if poller then
+        poller:del(csock)
+    end
+    csock:close()
+    session.v_csock = false
+
+    local session_list = self.v_session
+    local pos = session.v_pos
+    local last = session_list[#session_list]
+    session_list[pos] = last
+    last.v_pos = pos
+    session_list[#session_list] = nil
+    session.v_pos = false
+    self.v_stat.close = self.v_stat.close + 1
+end
+
 function session_mt:__tostring()
     local csock = self.v_csock
     if csock then
@@ -110,6 +245,9 @@ function session_mt:update_recv()
         return false, "break"
     end
 
+    local stat = self.v_server.v_stat
+    stat.recv_bytes = stat.recv_bytes + #data
+
     local none = on_handle(self.v_server, "recv", self, data)
     if not none then
         recv_buf:push(data)
@@ -119,26 +257,21 @@ end
 
 function session_mt:update_send()
     local send_buf = self.v_send_buf
-    local csock = self.v_csock
-    local v = send_buf:get_head_data()
-    local count = 0
+    if send_buf:size() == 0 then
+        return 0
+    end
 
-    while v do
-        local len = #v
-        local n, err = csock:send(v)
-        if not n then
-            return false, err
-        else
-            count = count + n
-            send_buf:pop(n)
-            if n < len then
-                break
-            end
+    local count, err = self.v_csock:sendv(send_buf)
+    if not count then
+        if pass_code[err] then
+            return 0
         end
-        v = send_buf:get_head_data()
+        return false, err
     end
-    
+
     if count > 0 then
+        local stat = self.v_server.v_stat
+        stat.send_bytes = stat.send_bytes + count
         on_handle(self.v_server, "send", self, count)
     end
 
@@ -148,27 +281,80 @@ end
 
 function session_mt:send_msg(msg)
     self.v_send_buf:push(msg.."\n")
+    sync_poll(self)
 end
 
 
-function mt:update()
-    local session_count = #self.v_session
-    local max_accept_count = self.v_max_accept_count
-    if max_accept_count and session_count <= max_accept_count then
-        local csock, err = self.v_sock:accept()
+-- 一直accept到EAGAIN或者session数达到上限
+local function accept(self)
+    local sock = self.v_sock
+    local session_list = self.v_session
+    local max_session = self.v_max_session
+    while not max_session or #session_list < max_session do
+        local csock, err = sock:accept()
         if csock then
             csock:setblocking(false)
             local session = new_session(self, csock)
             on_handle(self, "accept", session)
+        elseif err ~= EINTR then
+            break
         end
     end
+    sync_listen(self)
+end
 
-    -- 接受数据
-    local session_list = self.v_session
-    local session_list2 = self.__replace_session
-    session_count = #session_list
 
-    for i=1, session_count do
+-- 只处理poller返回的就绪session
+local function poll_update(self, timeout)
+    local ready = self.v_ready
+    local ready_events = self.v_ready_events
+    local listen_sock = self.v_sock
+    local n = self.v_poller:wait(ready, ready_events, timeout)
+    local closed = false
+
+    for i=1, n do
+        local obj = ready[i]
+        local events = ready_events[i]
+        if obj == listen_sock then
+            accept(self)
+        elseif obj.v_csock then
+            local ok, err = true, nil
+            if events & (EVENT_READ | EVENT_ERROR) ~= 0 then
+                ok, err = obj:update_recv()
+            end
+            if ok and events & EVENT_WRITE ~= 0 then
+                ok, err = obj:update_send()
+            end
+
+            if ok then
+                sync_poll(obj)
+            else
+                close_session(self, obj, err)
+                closed = true
+            end
+        end
+        ready[i] = nil
+    end
+
+    if closed then
+        sync_listen(self)
+    end
+end
+
+
+--[[
+timeout: 可选参数, poller等待的毫秒数, 默认为0不等待
+]]
+function mt:update(timeout)
+    if self.v_poller then
+        return poll_update(self, timeout)
+    end
+
+    accept(self)
+
+    -- 倒序遍历, 关闭session时与末尾交换不影响未处理的session
+    local session_list = self.v_session
+    for i=#session_list, 1, -1 do
         local ok, err
         local session = session_list[i]
         ok, err = session:update_recv()
@@ -177,17 +363,11 @@ function mt:update()
             ok, err = session:update_send()
         end
 
-        session_list[i] = nil
-        if ok then
-            session_list2[#session_list2+1] = session
-        else
-            on_handle(self, "error", session, err)
-            session.v_csock:close()
+        if not ok then
+            close_session(self, session, err)
         end
     end
-
-    self.v_session, self.__replace_session = session_list2, session_list
 end
 
 
-return new
\ No newline at end of file
+return new
@@ -0,0 +1,221 @@
+local socket = require "socket.c"
+local server_new = require "server"
+
+local EVENT_READ = socket.EVENT_READ
+
+local DEF_REPORT_INTERVAL = 1000
+local WORKER_WAIT = 10
+
+local mt = {}
+mt.__index = mt
+
+--[[
+server_cluster fork出多个worker进程, 每个worker用SO_REUSEPORT监听同一个端口,
+运行自己的server.update循环, 由内核在worker之间分配连接。
+worker通过socketpair定时上报统计, 父进程汇总。只能在支持fork和SO_REUSEPORT的平台使用。
+
+local cluster = server_cluster.start(host, port, worker_count, init [, report_interval])
+    init(server, worker_id): 在worker进程里调用, 用于注册handle
+    report_interval: worker上报统计的间隔毫秒数, 默认1000
+cluster:update([timeout])  -- 收集worker上报的统计, 返回存活的worker数
+cluster:stat()             -- {workers = {[id] = stat}, total = stat}, stat同server:stat
+cluster:stop()             -- 通知所有worker退出并等待
+]]
+
+local STAT_FIELDS = {"sessions", "accept", "close", "recv_bytes", "send_bytes"}
+
+
+local function report(srv, id, ctrl)
+    local st = srv:stat()
+    local line = tostring(id)
+    for i=1, #STAT_FIELDS do
+        line = line.." "..st[STAT_FIELDS[i]]
+    end
+    ctrl:send(line.."\n")
+end
+
+
+local function worker_main(id, host, port, init, ctrl, report_interval)
+    local srv, err = server_new(host, port, true)
+    if not srv then
+        print("worker", id, "listen error:", err)
+        return 1
+    end
+    init(srv, id)
+
+    -- 第一次上报通知父进程已经在监听
+    report(srv, id, ctrl)
+    ctrl:setblocking(false)
+    local last = socket.gettime()
+    while true do
+        srv:update(WORKER_WAIT)
+
+        local now = socket.gettime()
+        if now - last >= report_interval then
+            last = now
+            report(srv, id, ctrl)
+        end
+
+        -- 父进程关闭了socketpair
+        local data = ctrl:recv()
+        if data and #data == 0 then
+            break
+        end
+    end
+    return 0
+end
+
+
+local function worker_exit(self, worker)
+    self.v_poller:del(worker.sock)
+    worker.sock:close()
+    worker.alive = false
+    local _, code = socket.waitpid(worker.pid)
+    worker.exit_code = code
+end
+
+
+local function worker_recv(self, worker)
+    local data = worker.sock:recv()
+    if not data then
+        return
+    end
+    if #data == 0 then
+        worker_exit(self, worker)
+        return
+    end
+
+    data = worker.data..data
+    local pos = 1
+    for line, next_pos in data:gmatch("([^\n]*)\n()") do
+        local stat = {}
+        local i = 0
+        for v in line:gmatch("%d+") do
+            if i > 0 then
+                stat[STAT_FIELDS[i]] = tonumber(v)
+            end
+            i = i + 1
+        end
+        worker.stat = stat
+        pos = next_pos
+    end
+    worker.data = data:sub(pos)
+end
+
+
+local function start(host, port, worker_count, init, report_interval)
+    if not socket.fork or not socket.SO_REUSEPORT then
+        return false, "fork or SO_REUSEPORT not supported"
+    end
+    report_interval = report_interval or DEF_REPORT_INTERVAL
+
+    local self = {
+        v_poller = assert(socket.poller()),
+        v_workers = {},
+        v_ready = {},
+        v_ready_events = {},
+    }
+
+    for id=1, worker_count do
+        local parent_sock, child_sock = socket.socketpair()
+        if not parent_sock then
+            return false, child_sock
+        end
+
+        io.stdout:flush()
+        local pid, err = socket.fork()
+        if not pid then
+            return false, err
+        end
+
+        if pid == 0 then
+            -- worker进程只保留自己的socketpair, 其他worker的在父进程关闭时才能收到EOF
+            parent_sock:close()
+            for _, w in ipairs(self.v_workers) do
+                w.sock:close()
+            end
+            os.exit(worker_main(id, host, port, init, child_sock, report_interval))
+        end
+
+        child_sock:close()
+        local worker = {
+            id = id,
+            pid = pid,
+            sock = parent_sock,
+            alive = true,
+            data = "",
+            stat = false,
+        }
+        self.v_workers[id] = worker
+        self.v_poller:add(parent_sock, EVENT_READ, worker)
+
+        -- 等worker开始监听再fork下一个, 另一个SO_REUSEPORT socket处于bind之后listen之前时bind会返回EADDRINUSE
+        while worker.alive and not worker.stat do
+            worker_recv(self, worker)
+        end
+        parent_sock:setblocking(false)
+        if not worker.alive then
+            mt.stop(self)
+            return false, string.format("worker %d exit: %s", id, worker.exit_code)
+        end
+    end
+
+    return setmetatable(self, mt)
+end
+
+
+function mt:update(timeout)
+    local ready = self.v_ready
+    local ready_events = self.v_ready_events
+    local n = self.v_poller:wait(ready, ready_events, timeout)
+    for i=1, n do
+        local worker = ready[i]
+        ready[i] = nil
+        if worker.alive then
+            worker_recv(self, worker)
+        end
+    end
+
+    local alive = 0
+    for _, worker in ipairs(self.v_workers) do
+        if worker.alive then
+            alive = alive + 1
+        end
+    end
+    return alive
+end
+
+
+function mt:stat()
+    local total = {}
+    for i=1, #STAT_FIELDS do
+        total[STAT_FIELDS[i]] = 0
+    end
+
+    local workers = {}
+    for id, worker in ipairs(self.v_workers) do
+        local stat = worker.stat
+        if stat then
+            workers[id] = stat
+            for k, v in pairs(stat) do
+                total[k] = total[k] + v
+            end
+        end
+    end
+    return {workers = workers, total = total}
+end
+
+
+function mt:stop()
+    for _, worker in ipairs(self.v_workers) do
+        if worker.alive then
+            worker_exit(self, worker)
+        end
+    end
+    self.v_poller:close()
+end
+
+
+return {
+    start = start,
+}
@@ -0,0 +1,150 @@
+--[[
+stats 连接统计用的直方图和汇总函数, conn/sconn/conn_group共用
+
+local h = stats.histogram()
+stats.observe(h, v)             -- 记录一个非负数值
+stats.percentile(h, p)          -- p在0~1之间, 返回所在桶的上界
+stats.mean(h)
+stats.merge(dst, src)           -- 把统计表src累加到dst上, 返回dst
+stats.copy(t)                   -- 深拷贝统计表
+
+直方图按2的幂分桶: buckets[1]记录[0, 1), buckets[k]记录[2^(k-2), 2^(k-1)),
+计数、总和、最大最小值精确记录。
+统计表里的数值字段合并时相加, 名字以_max结尾的取最大值, 直方图合并各个桶,
+其他嵌套表递归合并。
+]]
+
+local log = math.log
+local floor = math.floor
+
+local function histogram()
+    return {
+        count = 0,
+        sum = 0,
+        min = false,
+        max = false,
+        buckets = {},
+    }
+end
+
+
+local function bucket_of(v)
+    if v < 1 then
+        return 1
+    end
+    return floor(log(v, 2)) + 2
+end
+
+
+local function observe(h, v)
+    h.count = h.count + 1
+    h.sum = h.sum + v
+    if not h.min or v < h.min then
+        h.min = v
+    end
+    if not h.max or v > h.max then
+        h.max = v
+    end
+    local buckets = h.buckets
+    local k = bucket_of(v)
+    buckets[k] = (buckets[k] or 0) + 1
+end
+
+
+local function percentile(h, p)
+    local count = h.count
+    if count == 0 then
+        return 0
+    end
+
+    local rank = math.max(1, math.ceil(count * p))
+    local buckets = h.buckets
+    local top = bucket_of(h.max)
+    local seen = 0
+    for k=1, top do
+        seen = seen + (buckets[k] or 0)
+        if seen >= rank then
+            -- 桶的上界, 不超过实际的最大值
+            local upper = 1 << (k-1)
+            return math.min(upper, h.max)
+        end
+    end
+    return h.max
+end
+
+
+local function mean(h)
+    if h.count == 0 then
+        return 0
+    end
+    return h.sum / h.count
+end
+
+
+local function merge_histogram(dst, src)
+    dst.count = dst.count + src.count
+    dst.sum = dst.sum + src.sum
+    if src.min and (not dst.min or src.min < dst.min) then
+        dst.min = src.min
+    end
+    if src.max and (not dst.max or src.max > dst.max) then
+        dst.max = src.max
+    end
+    local buckets = dst.buckets
+    for k, n in pairs(src.buckets) do
+        buckets[k] = (buckets[k] or 0) + n
+    end
+    return dst
+end
+
+
+local function merge(dst, src)
+    if src.buckets then
+        return merge_histogram(dst, src)
+    end
+
+    for k, v in pairs(src) do
+        local tv = type(v)
+        local old = dst[k]
+        if tv == "number" then
+            if old == nil then
+                dst[k] = v
+            elseif type(k) == "string" and k:sub(-4) == "_max" then
+                dst[k] = math.max(old, v)
+            else
+                dst[k] = old + v
+            end
+        elseif tv == "table" then
+            if old == nil then
+                old = v.buckets and histogram() or {}
+                dst[k] = old
+            end
+            merge(old, v)
+        elseif old == nil then
+            dst[k] = v
+        end
+    end
+    return dst
+end
+
+
+local function copy(t)
+    local ret = {}
+    for k, v in pairs(t) do
+        if type(v) == "table" then
+            v = copy(v)
+        end
+        ret[k] = v
+    end
+    return ret
+end
+
+
+return {
+    histogram = histogram,
+    observe = observe,
+    percentile = percentile,
+    mean = mean,
+    merge = merge,
+    copy = copy,
+}
@@ -0,0 +1,75 @@
+-- 回环上的请求/应答延迟: 客户端把包头和包体分两次写, 服务器收到完整消息才回复,
+-- 不设置nodelay时第二次写会等第一次的ACK(延迟ACK约40ms)
+-- lua test/bench_nodelay.lua [rounds]
+local conn = require "conn"
+local server_new = require "server"
+local socket = require "socket.c"
+
+local rounds = tonumber((...)) or 200
+local port = 7520
+
+local server = assert(server_new("127.0.0.1", port))
+server:register_handle("recv", function (session, data)
+    local recv_buf = session.v_recv_buf
+    recv_buf:push(data)
+    while true do
+        local msg = recv_buf:pop_block(2, "big")
+        if not msg then
+            break
+        end
+        session.v_send_buf:push(string.pack(">s2", msg))
+    end
+    return true
+end)
+
+
+local function run(options)
+    local sock = assert(conn.connect_host("127.0.0.1", port, options))
+    local body = string.rep("x", 32)
+    local header = string.pack(">I2", #body)
+    local out = {}
+    local rtt = {}
+
+    while true do
+        server:update(0)
+        local success, err, status = sock:update()
+        assert(success, err)
+        if status == "forward" then
+            break
+        end
+    end
+
+    for i=1, rounds do
+        local t = socket.gettime()
+        sock:send(header)
+        sock:flush_send()
+        sock:send(body)
+        sock:flush_send()
+
+        local msg
+        repeat
+            server:update(1)
+            assert(sock:update())
+            msg = sock:pop_msg(2, "big")
+        until msg
+        rtt[i] = socket.gettime() - t
+    end
+    sock:close()
+
+    table.sort(rtt)
+    local sum = 0
+    for i=1, #rtt do
+        sum = sum + rtt[i]
+    end
+    return sum / #rtt, rtt[#rtt // 2 + 1], rtt[math.ceil(#rtt * 0.99)]
+end
+
+
+for _, case in ipairs {
+    {"default", nil},
+    {"nodelay", {nodelay = true}},
+    {"nodelay+quickack", {nodelay = true, quickack = true}},
+} do
+    local avg, p50, p99 = run(case[2])
+    print(string.format("%-18s rounds:%d avg:%.2fms p50:%dms p99:%dms", case[1], rounds, avg, p50, p99))
+end
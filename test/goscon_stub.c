@@ -0,0 +1,886 @@
+/*
+ * goscon_stub.c
+ * a local stand-in for the goscon server, so sconn.lua can be tested and
+ * benchmarked without building the go submodule. posix only.
+ *
+ * newconnect: dh key exchange, then everything the client sends is rc4
+ * decrypted and echoed back rc4 encrypted.
+ * reconnect: checks the hmac and the index, acks with the number of bytes
+ * received from the client and replays the bytes the client missed from a
+ * per session cache of the server to client stream.
+ *
+ * fault injection, applied to every connection:
+ *   -d bytes  close the connection after receiving this many stream bytes,
+ *             the rest of the read is dropped and must be replayed
+ *   -t bytes  when closing because of -d, write at most this many of the
+ *             pending bytes first, so the client sees a truncated stream
+ *   -l ms     hold the echoed data this long before writing it
+ *
+ * usage: goscon_stub [-h host] [-p port] [-c cache_bytes] [-e expire_seconds]
+ *                    [-d bytes] [-t bytes] [-l ms] [-s seconds] [-w]
+ *   -c  replay cache of each session, default 65536
+ *   -e  free a session this long after its last connection closed, default 60
+ *   -s  print a json stat line every n seconds
+ *   -w  exit when stdin is closed, for running under io.popen
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#ifdef __linux__
+#  include <sys/epoll.h>
+#else
+#  include <poll.h>
+#endif
+
+#include "buffer.h"
+#include "crypt.h"
+#include "rc4.h"
+
+#define READ_CHUNK (64*1024)
+#define MAX_EVENTS (1024)
+#define MAX_HANDSHAKE (1024)
+#define DEF_CACHE_BYTES (64*1024)
+#define DEF_EXPIRE (60)
+
+struct session {
+  int id;
+  uint32_t secret[2];
+  struct rc4_state c2s;
+  struct rc4_state s2c;
+  uint64_t recv;      // stream bytes received from the client
+  uint64_t sent;      // stream bytes produced for the client
+  long index;         // last accepted reconnect index
+  struct buffer cache;  // tail of the server to client stream
+  struct conn *conn;
+  uint64_t closed_at;
+};
+
+// echoed data held back by -l
+struct chunk {
+  struct chunk *next;
+  uint64_t due;
+  int fd;
+  uint64_t serial;
+  size_t len;
+  char data[];
+};
+
+struct conn {
+  int fd;
+  uint64_t serial;
+  struct session *session;
+  struct buffer in;   // handshake bytes
+  struct buffer out;  // bytes ready to write
+  uint64_t received;
+  int writing;
+};
+
+static struct {
+  const char *host;
+  int port;
+  size_t cache_bytes;
+  uint64_t expire;
+  uint64_t drop_after;
+  long truncate;
+  uint64_t delay;
+  int stat_interval;
+  int watch_stdin;
+} opt = {"127.0.0.1", 1248, DEF_CACHE_BYTES, DEF_EXPIRE*1000, 0, -1, 0, 0, 0};
+
+static struct {
+  long conns;
+  long newconnect;
+  long reconnect;
+  long reconnect_fail;
+  long drops;
+  uint64_t recv_bytes;
+  uint64_t send_bytes;
+  uint64_t replay_bytes;
+} stat;
+
+static int listen_fd = -1;
+static uint64_t next_serial = 1;
+
+// conns by fd, sessions by id
+static struct conn **conns = NULL;
+static int conn_cap = 0;
+static struct session **sessions = NULL;
+static int session_cap = 0;
+static int session_count = 0;
+static int last_session_id = 0;
+
+static struct chunk *delayed_head = NULL;
+static struct chunk *delayed_tail = NULL;
+
+static uint64_t
+now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void *
+xrealloc(void *p, size_t sz) {
+  p = realloc(p, sz);
+  if (p == NULL) {
+    fprintf(stderr, "goscon_stub: out of memory\n");
+    exit(1);
+  }
+  return p;
+}
+
+static void
+set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* poller: epoll on linux, poll elsewhere. ud is the fd */
+
+#ifdef __linux__
+
+static int epoll_fd = -1;
+
+static int
+poller_init(void) {
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  return epoll_fd < 0 ? -1 : 0;
+}
+
+static void
+poller_ctl(int op, int fd, int write) {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | (write ? EPOLLOUT : 0);
+  ev.data.fd = fd;
+  epoll_ctl(epoll_fd, op, fd, &ev);
+}
+
+static void poller_add(int fd) { poller_ctl(EPOLL_CTL_ADD, fd, 0); }
+static void poller_mod(int fd, int write) { poller_ctl(EPOLL_CTL_MOD, fd, write); }
+static void poller_del(int fd) { poller_ctl(EPOLL_CTL_DEL, fd, 0); }
+
+// fill fds/writable, return count
+static int
+poller_wait(int fds[], int writable[], int timeout) {
+  struct epoll_event evs[MAX_EVENTS];
+  int i, n = epoll_wait(epoll_fd, evs, MAX_EVENTS, timeout);
+  for (i=0; i<n; i++) {
+    fds[i] = evs[i].data.fd;
+    writable[i] = (evs[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) != 0;
+  }
+  return n < 0 ? 0 : n;
+}
+
+#else
+
+static struct pollfd *pfds = NULL;
+static int pfd_count = 0;
+static int pfd_cap = 0;
+static int *pfd_index = NULL;  // fd -> index in pfds
+static int pfd_index_cap = 0;
+
+static int
+poller_init(void) {
+  return 0;
+}
+
+static void
+poller_add(int fd) {
+  if (pfd_count == pfd_cap) {
+    pfd_cap = pfd_cap ? pfd_cap * 2 : 64;
+    pfds = xrealloc(pfds, pfd_cap * sizeof(*pfds));
+  }
+  if (fd >= pfd_index_cap) {
+    int cap = pfd_index_cap ? pfd_index_cap : 64;
+    while (cap <= fd) {
+      cap *= 2;
+    }
+    pfd_index = xrealloc(pfd_index, cap * sizeof(int));
+    pfd_index_cap = cap;
+  }
+  pfds[pfd_count].fd = fd;
+  pfds[pfd_count].events = POLLIN;
+  pfds[pfd_count].revents = 0;
+  pfd_index[fd] = pfd_count++;
+}
+
+static void
+poller_mod(int fd, int write) {
+  pfds[pfd_index[fd]].events = POLLIN | (write ? POLLOUT : 0);
+}
+
+static void
+poller_del(int fd) {
+  int i = pfd_index[fd];
+  pfds[i] = pfds[--pfd_count];
+  pfd_index[pfds[i].fd] = i;
+}
+
+static int
+poller_wait(int fds[], int writable[], int timeout) {
+  int i, n = 0;
+  if (poll(pfds, pfd_count, timeout) <= 0) {
+    return 0;
+  }
+  for (i=0; i<pfd_count && n<MAX_EVENTS; i++) {
+    short re = pfds[i].revents;
+    if (re == 0) {
+      continue;
+    }
+    fds[n] = pfds[i].fd;
+    writable[n] = (re & (POLLOUT | POLLERR | POLLHUP)) != 0;
+    n++;
+  }
+  return n;
+}
+
+#endif
+
+/* 64bit values as 8 little endian bytes, the layout of the lua strings */
+
+static void
+u64_to_words(uint64_t v, uint32_t w[2]) {
+  w[0] = (uint32_t)v;
+  w[1] = (uint32_t)(v >> 32);
+}
+
+static void
+bytes_to_words(const uint8_t b[8], uint32_t w[2]) {
+  w[0] = b[0] | b[1]<<8 | b[2]<<16 | (uint32_t)b[3]<<24;
+  w[1] = b[4] | b[5]<<8 | b[6]<<16 | (uint32_t)b[7]<<24;
+}
+
+static void
+words_to_bytes(const uint32_t w[2], uint8_t b[8]) {
+  int i;
+  for (i=0; i<4; i++) {
+    b[i] = (w[0] >> (i*8)) & 0xff;
+    b[i+4] = (w[1] >> (i*8)) & 0xff;
+  }
+}
+
+/* sessions */
+
+static struct session *
+session_new(void) {
+  struct session *s = xrealloc(NULL, sizeof(*s));
+  memset(s, 0, sizeof(*s));
+  s->id = ++last_session_id;
+  buffer_init(&s->cache);
+  if (s->id >= session_cap) {
+    int cap = session_cap ? session_cap * 2 : 1024;
+    sessions = xrealloc(sessions, cap * sizeof(*sessions));
+    memset(sessions + session_cap, 0, (cap - session_cap) * sizeof(*sessions));
+    session_cap = cap;
+  }
+  sessions[s->id] = s;
+  session_count++;
+  return s;
+}
+
+static void
+session_free(struct session *s) {
+  sessions[s->id] = NULL;
+  buffer_free(&s->cache);
+  free(s);
+  session_count--;
+}
+
+static struct session *
+session_get(long id) {
+  if (id <= 0 || id >= session_cap) {
+    return NULL;
+  }
+  return sessions[id];
+}
+
+static void
+expire_sessions(uint64_t now) {
+  int i;
+  for (i=1; i<=last_session_id && i<session_cap; i++) {
+    struct session *s = sessions[i];
+    if (s && s->conn == NULL && now - s->closed_at >= opt.expire) {
+      session_free(s);
+    }
+  }
+}
+
+/* connections */
+
+static struct conn *
+conn_get(int fd) {
+  return fd < conn_cap ? conns[fd] : NULL;
+}
+
+static void
+conn_new(int fd) {
+  struct conn *c;
+  if (fd >= conn_cap) {
+    int cap = conn_cap ? conn_cap : 1024;
+    while (cap <= fd) {
+      cap *= 2;
+    }
+    conns = xrealloc(conns, cap * sizeof(*conns));
+    memset(conns + conn_cap, 0, (cap - conn_cap) * sizeof(*conns));
+    conn_cap = cap;
+  }
+  c = xrealloc(NULL, sizeof(*c));
+  memset(c, 0, sizeof(*c));
+  c->fd = fd;
+  c->serial = next_serial++;
+  buffer_init(&c->in);
+  buffer_init(&c->out);
+  conns[fd] = c;
+  poller_add(fd);
+  stat.conns++;
+}
+
+static void
+conn_close(struct conn *c) {
+  struct session *s = c->session;
+  if (s && s->conn == c) {
+    s->conn = NULL;
+    s->closed_at = now_ms();
+  }
+  poller_del(c->fd);
+  close(c->fd);
+  conns[c->fd] = NULL;
+  buffer_free(&c->in);
+  buffer_free(&c->out);
+  free(c);
+  stat.conns--;
+}
+
+// write as much of out as the socket takes, return -1 on error
+static int
+conn_flush(struct conn *c) {
+  while (c->out.size > 0) {
+    const char *seg[2];
+    size_t len[2];
+    ssize_t n;
+    buffer_readable(&c->out, seg, len);
+    n = send(c->fd, seg[0], len[0], MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      return -1;
+    }
+    buffer_drop(&c->out, (size_t)n);
+    stat.send_bytes += n;
+  }
+
+  int writing = c->out.size > 0;
+  if (writing != c->writing) {
+    poller_mod(c->fd, writing);
+    c->writing = writing;
+  }
+  return 0;
+}
+
+static void
+conn_send(struct conn *c, const void *data, size_t sz) {
+  if (buffer_push(&c->out, data, sz) != 0) {
+    fprintf(stderr, "goscon_stub: out of memory\n");
+    exit(1);
+  }
+}
+
+// handshake reply with the 2 byte big endian length header
+static void
+conn_send_frame(struct conn *c, const char *msg, size_t sz) {
+  uint8_t header[2];
+  header[0] = (sz >> 8) & 0xff;
+  header[1] = sz & 0xff;
+  conn_send(c, header, 2);
+  conn_send(c, msg, sz);
+}
+
+// close for -d: write at most -t bytes of the pending data first
+static void
+conn_drop(struct conn *c) {
+  stat.drops++;
+  if (opt.truncate >= 0 && c->out.size > (size_t)opt.truncate) {
+    c->out.size = (size_t)opt.truncate;
+  }
+  conn_flush(c);
+  conn_close(c);
+}
+
+/* the stream */
+
+static void
+cache_append(struct session *s, const char *data, size_t sz) {
+  if (opt.cache_bytes == 0) {
+    return;
+  }
+  if (sz >= opt.cache_bytes) {
+    buffer_clear(&s->cache);
+    data += sz - opt.cache_bytes;
+    sz = opt.cache_bytes;
+  } else if (s->cache.size + sz > opt.cache_bytes) {
+    buffer_drop(&s->cache, s->cache.size + sz - opt.cache_bytes);
+  }
+  buffer_push(&s->cache, data, sz);
+}
+
+static void
+delay_push(struct conn *c, const char *data, size_t sz, uint64_t now) {
+  struct chunk *ck = xrealloc(NULL, sizeof(*ck) + sz);
+  ck->next = NULL;
+  ck->due = now + opt.delay;
+  ck->fd = c->fd;
+  ck->serial = c->serial;
+  ck->len = sz;
+  memcpy(ck->data, data, sz);
+  if (delayed_tail) {
+    delayed_tail->next = ck;
+  } else {
+    delayed_head = ck;
+  }
+  delayed_tail = ck;
+}
+
+// write the chunks that are due, return ms until the next one or -1
+static int
+delay_update(uint64_t now) {
+  while (delayed_head && delayed_head->due <= now) {
+    struct chunk *ck = delayed_head;
+    struct conn *c = conn_get(ck->fd);
+    delayed_head = ck->next;
+    if (delayed_head == NULL) {
+      delayed_tail = NULL;
+    }
+    if (c && c->serial == ck->serial) {
+      conn_send(c, ck->data, ck->len);
+      if (conn_flush(c) != 0) {
+        conn_close(c);
+      }
+    }
+    free(ck);
+  }
+  return delayed_head ? (int)(delayed_head->due - now) : -1;
+}
+
+// decrypt, encrypt back and queue. data is modified in place
+static void
+echo(struct conn *c, char *data, size_t sz) {
+  struct session *s = c->session;
+  librc4_crypt(&s->c2s, (const uint8_t *)data, (uint8_t *)data, (int)sz);
+  librc4_crypt(&s->s2c, (const uint8_t *)data, (uint8_t *)data, (int)sz);
+  s->recv += sz;
+  s->sent += sz;
+  cache_append(s, data, sz);
+
+  if (opt.delay > 0) {
+    delay_push(c, data, sz, now_ms());
+  } else {
+    conn_send(c, data, sz);
+  }
+}
+
+/* handshake */
+
+// split a message into at most n lines, return the line count
+static int
+split_lines(char *msg, char *lines[], int n) {
+  int count = 0;
+  char *p = msg;
+  while (count < n) {
+    char *nl = strchr(p, '\n');
+    lines[count++] = p;
+    if (nl == NULL) {
+      break;
+    }
+    *nl = '\0';
+    p = nl + 1;
+  }
+  return count;
+}
+
+static int
+newconnect(struct conn *c, char *lines[], int count) {
+  uint8_t clientkey[CRYPT_B64_DECODE_SIZE(MAX_HANDSHAKE)];
+  uint8_t serverkey[8], pub[8], rc4_key[32];
+  uint32_t ck[2], sk[2], w[2], r[2];
+  char b64[CRYPT_B64_ENCODE_SIZE(8) + 1];
+  char reply[64];
+  struct session *s;
+  int i, sz;
+
+  if (count < 2) {
+    return -1;
+  }
+  if (crypt_b64decode((const uint8_t *)lines[1], strlen(lines[1]), clientkey, 1) != 8) {
+    return -1;
+  }
+  bytes_to_words(clientkey, ck);
+  if ((ck[0] | ck[1]) == 0) {
+    return -1;
+  }
+
+  crypt_randomkey(serverkey);
+  bytes_to_words(serverkey, sk);
+  uint64_t private_key = (uint64_t)sk[0] | (uint64_t)sk[1] << 32;
+  uint64_t client_pub = (uint64_t)ck[0] | (uint64_t)ck[1] << 32;
+
+  s = session_new();
+  u64_to_words(crypt_powmodp(client_pub, private_key), s->secret);
+  for (i=0; i<4; i++) {
+    w[0] = i;
+    w[1] = 0;
+    crypt_hmac64_md5(s->secret, w, r);
+    words_to_bytes(r, rc4_key + i*8);
+  }
+  librc4_init(&s->c2s, rc4_key, 32);
+  librc4_init(&s->s2c, rc4_key, 32);
+  s->conn = c;
+  c->session = s;
+
+  u64_to_words(crypt_powmodp(CRYPT_DH_G, private_key), w);
+  words_to_bytes(w, pub);
+  b64[crypt_b64encode(pub, 8, b64)] = '\0';
+  sz = snprintf(reply, sizeof(reply), "%d\n%s", s->id, b64);
+  conn_send_frame(c, reply, sz);
+  stat.newconnect++;
+  return 0;
+}
+
+static int
+reconnect_error(struct conn *c, const char *code) {
+  char reply[32];
+  int sz = snprintf(reply, sizeof(reply), "0\n%s", code);
+  conn_send_frame(c, reply, sz);
+  stat.reconnect_fail++;
+  return -1;
+}
+
+static int
+reconnect(struct conn *c, char *lines[], int count) {
+  char content[MAX_HANDSHAKE];
+  uint8_t key[8], mac[8];
+  uint32_t kw[2], r[2];
+  char b64[CRYPT_B64_ENCODE_SIZE(8) + 1];
+  char reply[64];
+  struct session *s;
+  long id, index;
+  unsigned long long client_recv;
+  uint64_t missing;
+  int sz;
+
+  if (count < 4) {
+    return reconnect_error(c, "400");
+  }
+  id = strtol(lines[0], NULL, 10);
+  index = strtol(lines[1], NULL, 10);
+  client_recv = strtoull(lines[2], NULL, 10);
+
+  s = session_get(id);
+  if (s == NULL) {
+    return reconnect_error(c, "404");
+  }
+
+  // hmac64_md5(hashkey("id\nindex\nrecv\n"), secret)
+  sz = snprintf(content, sizeof(content), "%s\n%s\n%s\n", lines[0], lines[1], lines[2]);
+  crypt_hashkey(content, sz, key);
+  bytes_to_words(key, kw);
+  crypt_hmac64_md5(kw, s->secret, r);
+  words_to_bytes(r, mac);
+  b64[crypt_b64encode(mac, 8, b64)] = '\0';
+  if (strcmp(b64, lines[3]) != 0) {
+    return reconnect_error(c, "401");
+  }
+  if (index <= s->index) {
+    return reconnect_error(c, "403");
+  }
+  if (client_recv > s->sent) {
+    return reconnect_error(c, "406");
+  }
+  missing = s->sent - client_recv;
+  if (missing > s->cache.size) {
+    return reconnect_error(c, "406");
+  }
+
+  if (s->conn) {
+    conn_close(s->conn);
+  }
+  s->index = index;
+  s->conn = c;
+  c->session = s;
+
+  sz = snprintf(reply, sizeof(reply), "%llu\n200", (unsigned long long)s->recv);
+  conn_send_frame(c, reply, sz);
+  if (missing > 0) {
+    buffer_copy(&c->out, &s->cache, s->cache.size - missing, missing);
+    stat.replay_bytes += missing;
+  }
+  stat.reconnect++;
+  return 0;
+}
+
+// parse the handshake frame from c->in, return 1 when done, 0 for more data, -1 to close
+static int
+handshake(struct conn *c) {
+  uint8_t header[2];
+  char msg[MAX_HANDSHAKE + 1];
+  char *lines[4];
+  size_t sz;
+  int count;
+
+  if (buffer_peek(&c->in, 0, header, 2) < 2) {
+    return 0;
+  }
+  sz = header[0] << 8 | header[1];
+  if (sz > MAX_HANDSHAKE) {
+    return -1;
+  }
+  if (c->in.size < sz + 2) {
+    return 0;
+  }
+  buffer_peek(&c->in, 2, msg, sz);
+  msg[sz] = '\0';
+  buffer_drop(&c->in, sz + 2);
+
+  count = split_lines(msg, lines, 4);
+  if (count >= 1 && strcmp(lines[0], "0") == 0) {
+    return newconnect(c, lines, count) == 0 ? 1 : -1;
+  }
+  return reconnect(c, lines, count) == 0 ? 1 : -1;
+}
+
+// feed stream bytes, apply -d. return -1 when the connection is dropped
+static int
+forward(struct conn *c, char *data, size_t sz) {
+  int drop = 0;
+  if (opt.drop_after > 0 && c->received + sz >= opt.drop_after) {
+    sz = (size_t)(opt.drop_after - c->received);
+    drop = 1;
+  }
+  c->received += sz;
+  if (sz > 0) {
+    echo(c, data, sz);
+  }
+  if (drop) {
+    conn_drop(c);
+    return -1;
+  }
+  return 0;
+}
+
+static void
+conn_read(struct conn *c) {
+  static char buf[READ_CHUNK];
+  for (;;) {
+    ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      conn_close(c);
+      return;
+    }
+    if (n == 0) {
+      conn_close(c);
+      return;
+    }
+    stat.recv_bytes += n;
+
+    if (c->session == NULL) {
+      int ret;
+      buffer_push(&c->in, buf, (size_t)n);
+      ret = handshake(c);
+      if (ret < 0) {
+        conn_flush(c);
+        conn_close(c);
+        return;
+      }
+      // stream bytes that came with the handshake
+      while (ret > 0 && c->in.size > 0) {
+        size_t sz = buffer_peek(&c->in, 0, buf, sizeof(buf));
+        buffer_drop(&c->in, sz);
+        if (forward(c, buf, sz) != 0) {
+          return;
+        }
+      }
+      continue;
+    }
+
+    if (forward(c, buf, (size_t)n) != 0) {
+      return;
+    }
+    if ((size_t)n < sizeof(buf)) {
+      break;
+    }
+  }
+
+  if (conn_flush(c) != 0) {
+    conn_close(c);
+  }
+}
+
+static void
+do_accept(void) {
+  for (;;) {
+    int fd = accept(listen_fd, NULL, NULL);
+    int on = 1;
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    set_nonblocking(fd);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void *)&on, sizeof(on));
+    conn_new(fd);
+  }
+}
+
+static int
+do_listen(void) {
+  struct sockaddr_in addr;
+  int on = 1;
+
+  listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    return -1;
+  }
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, (void *)&on, sizeof(on));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(opt.port);
+  if (inet_pton(AF_INET, opt.host, &addr.sin_addr) != 1) {
+    return -1;
+  }
+  if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    return -1;
+  }
+  if (listen(listen_fd, SOMAXCONN) != 0) {
+    return -1;
+  }
+  set_nonblocking(listen_fd);
+  poller_add(listen_fd);
+  return 0;
+}
+
+static void
+print_stat(void) {
+  printf("{\"sessions\":%d,\"conns\":%ld,\"newconnect\":%ld,\"reconnect\":%ld,"
+    "\"reconnect_fail\":%ld,\"drops\":%ld,\"recv_bytes\":%llu,\"send_bytes\":%llu,"
+    "\"replay_bytes\":%llu}\n",
+    session_count, stat.conns, stat.newconnect, stat.reconnect,
+    stat.reconnect_fail, stat.drops, (unsigned long long)stat.recv_bytes,
+    (unsigned long long)stat.send_bytes, (unsigned long long)stat.replay_bytes);
+  fflush(stdout);
+}
+
+static void
+usage(void) {
+  fprintf(stderr, "usage: goscon_stub [-h host] [-p port] [-c cache_bytes] [-e expire_seconds]\n"
+    "                   [-d drop_after_bytes] [-t truncate_bytes] [-l delay_ms] [-s stat_seconds] [-w]\n");
+  exit(1);
+}
+
+int
+main(int argc, char *argv[]) {
+  int fds[MAX_EVENTS], writable[MAX_EVENTS];
+  uint64_t next_stat = 0, next_expire = 0;
+  int ch;
+
+  while ((ch = getopt(argc, argv, "h:p:c:e:d:t:l:s:w")) != -1) {
+    switch (ch) {
+    case 'h': opt.host = optarg; break;
+    case 'p': opt.port = atoi(optarg); break;
+    case 'c': opt.cache_bytes = (size_t)strtoull(optarg, NULL, 10); break;
+    case 'e': opt.expire = strtoull(optarg, NULL, 10) * 1000; break;
+    case 'd': opt.drop_after = strtoull(optarg, NULL, 10); break;
+    case 't': opt.truncate = atol(optarg); break;
+    case 'l': opt.delay = strtoull(optarg, NULL, 10); break;
+    case 's': opt.stat_interval = atoi(optarg); break;
+    case 'w': opt.watch_stdin = 1; break;
+    default: usage();
+    }
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  srandom((unsigned)time(NULL) ^ (unsigned)getpid());
+  if (poller_init() != 0 || do_listen() != 0) {
+    fprintf(stderr, "goscon_stub: listen %s:%d: %s\n", opt.host, opt.port, strerror(errno));
+    return 1;
+  }
+  if (opt.watch_stdin) {
+    poller_add(STDIN_FILENO);
+  }
+  fprintf(stderr, "goscon_stub: listen %s:%d\n", opt.host, opt.port);
+
+  for (;;) {
+    uint64_t now = now_ms();
+    int timeout = delay_update(now);
+    int i, n;
+
+    if (opt.stat_interval > 0) {
+      if (now >= next_stat) {
+        if (next_stat > 0) {
+          print_stat();
+        }
+        next_stat = now + opt.stat_interval * 1000;
+      }
+      if (timeout < 0 || next_stat - now < (uint64_t)timeout) {
+        timeout = (int)(next_stat - now);
+      }
+    }
+    if (now >= next_expire) {
+      expire_sessions(now);
+      next_expire = now + 1000;
+    }
+    if (timeout < 0 || timeout > 1000) {
+      timeout = 1000;
+    }
+
+    n = poller_wait(fds, writable, timeout);
+    for (i=0; i<n; i++) {
+      int fd = fds[i];
+      struct conn *c;
+      if (fd == listen_fd) {
+        do_accept();
+        continue;
+      }
+      if (fd == STDIN_FILENO && opt.watch_stdin) {
+        char tmp[256];
+        if (read(STDIN_FILENO, tmp, sizeof(tmp)) <= 0) {
+          return 0;
+        }
+        continue;
+      }
+      c = conn_get(fd);
+      if (c == NULL) {
+        continue;
+      }
+      if (writable[i] && conn_flush(c) != 0) {
+        conn_close(c);
+        continue;
+      }
+      conn_read(c);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,47 @@
+-- 用conn_group驱动大量连接, 配合test/server_handle.lua使用
+-- lua test/group_client.lua [count]
+local conn = require "conn"
+local conn_group = require "conn_group"
+
+local count = tonumber((...)) or 1000
+
+local recv_count = 0
+local out = {}
+
+local function handle(sock, success, err, status)
+    if not success then
+        print("error:", err, status)
+        return
+    end
+
+    local n = sock:recv(out)
+    for i=1, n do
+        recv_count = recv_count + #out[i]
+        out[i] = nil
+    end
+end
+
+local group = assert(conn_group.new(handle))
+local socks = {}
+for i=1, count do
+    local sock, err = conn.connect_host("127.0.0.1", 7510)
+    assert(sock, err)
+    group:add(sock)
+    socks[i] = sock
+end
+
+local tick = 0
+while true do
+    tick = tick + 1
+    group:update(10)
+
+    if tick % 100 == 0 then
+        for i=1, #socks do
+            socks[i]:send("return "..tick)
+        end
+
+        local st = group:stat()
+        print(string.format("tick:%d count:%d waits:%d updates:%d errors:%d last_ready:%d recv:%d",
+            tick, st.count, st.waits, st.updates, st.errors, st.last_ready, recv_count))
+    end
+end
@@ -0,0 +1,34 @@
+-- 多进程echo服务器, 每秒打印各worker的统计
+-- lua test/server_cluster.lua [worker_count]
+local server_cluster = require "server_cluster"
+local socket = require "socket.c"
+
+local worker_count = tonumber((...)) or 4
+
+local function init(server, id)
+    server:set_max_session(false)
+    server:register_handle("recv", function (session, data)
+        session.v_send_buf:push(data)
+        return true
+    end)
+end
+
+local cluster, err = server_cluster.start("127.0.0.1", 7510, worker_count, init)
+assert(cluster, err)
+print("listen...")
+
+local last = socket.gettime()
+while cluster:update(100) > 0 do
+    local now = socket.gettime()
+    if now - last >= 1000 then
+        last = now
+        local stat = cluster:stat()
+        for id, st in pairs(stat.workers) do
+            print(string.format("worker:%d sessions:%d accept:%d recv:%d send:%d",
+                id, st.sessions, st.accept, st.recv_bytes, st.send_bytes))
+        end
+        local total = stat.total
+        print(string.format("total sessions:%d accept:%d recv:%d send:%d",
+            total.sessions, total.accept, total.recv_bytes, total.send_bytes))
+    end
+end
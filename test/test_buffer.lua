@@ -2,8 +2,6 @@ local buffer_queue = require "buffer_queue"
 
 local q1 = buffer_queue.create()
 
-q1:dump()
-print("<<<<<<<<<<<<<<<<<<<<<<<<")
 q1:push("12")
 q1:push("34")
 q1:push("56789")
@@ -15,7 +13,52 @@ local data = string.pack("<s2", s)
 print("### pop:", q1:pop(15))
 -- q1:push("aaaa")
 q1:push(data)
-local ss = q1:pop_block()
+local ss = q1:pop_block(2, "little")
 print("$$$$ ss:", ss, #ss)
+assert(ss == s)
 
-q1:dump()
\ No newline at end of file
+-- wrap around the ring
+local q2 = buffer_queue.create()
+local out = {}
+for i=1,1000 do
+    q2:push_block(string.rep(tostring(i), i % 37), 2, "big")
+    if i % 3 == 0 then
+        local count = q2:pop_all_block(out, 2, "big")
+        assert(count > 0)
+    end
+end
+assert(q2:pop_all_block(out, 2, "big") == 1)
+assert(out[1] == string.rep("1000", 1000 % 37))
+assert(q2:size() == 0)
+
+-- byte limited tail, as the sconn replay cache uses it
+local cache = buffer_queue.create()
+local all = {}
+for i=1,2000 do
+    local v = string.rep(string.char(i % 256), i % 61)
+    cache:push(v)
+    all[#all+1] = v
+    cache:trim(5000)
+end
+local tail = table.concat(all):sub(-5000)
+assert(cache:size() == 5000)
+local q3 = buffer_queue.create()
+assert(cache:copy_tail(q3, 1234) == 1234)
+assert(q3:pop() == tail:sub(-1234))
+assert(cache:copy_tail(q3, 5001) == false)
+assert(cache:size() == 5000)
+assert(cache:pop() == tail)
+
+-- empty push and copy on an exactly full buffer (4096 is the first capacity)
+local full = buffer_queue.create()
+local block = string.rep("f", 4096)
+full:push(block)
+full:push("")
+assert(full:size() == 4096)
+assert(full:copy_tail(q3, 0) == 0)
+assert(q3:size() == 0)
+local full2 = buffer_queue.create()
+full2:push(block)
+assert(full:copy_tail(full2, 0) == 0)
+assert(full2:size() == 4096)
+assert(full:pop() == block)
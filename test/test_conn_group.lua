@@ -0,0 +1,50 @@
+-- a failed async lookup is reported by the group that owns the conn,
+-- whichever group drained the shared resolver
+local socket = require "socket.c"
+local conn = require "conn"
+local conn_group = require "conn_group"
+
+if not socket.poller or not conn.resolve_socket() then
+    print("test_conn_group skipped, no poller or async resolver")
+    return
+end
+
+local HOST = "no-such-host.invalid"
+
+local reports = {}
+local function handle(sock, success, err, status)
+    reports[#reports+1] = {sock = sock, success = success, err = err, status = status}
+end
+
+local g1 = assert(conn_group.new(handle))
+local g2 = assert(conn_group.new(handle))
+
+local c1 = assert(conn.connect_host(HOST, 7))
+local c2 = assert(conn.connect_host(HOST, 7))
+g1:add(c1)
+g2:add(c2)
+
+-- only g1 waits, so it drains both results
+local deadline = socket.gettime() + 10000
+while not c2.v_error and socket.gettime() < deadline do
+    g1:update(10)
+end
+assert(c2.v_error, "lookup didn't finish")
+assert(#reports == 1 and reports[1].sock == c1, "g1 should report only its own conn")
+assert(not reports[1].success and reports[1].status == "connect")
+
+-- g2 reports its conn on the next update without waiting for the timeout
+local t = socket.gettime()
+g2:update(5000)
+assert(socket.gettime() - t < 1000, "g2 waited for the timeout")
+assert(#reports == 2 and reports[2].sock == c2, "g2 didn't report its conn")
+assert(not reports[2].success and reports[2].status == "connect")
+
+-- reported once
+g1:update(0)
+g2:update(0)
+assert(#reports == 2)
+
+g1:clear()
+g2:clear()
+print("test_conn_group ok", reports[2].err)
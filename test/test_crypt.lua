@@ -0,0 +1,129 @@
+-- every simd level of crypt (base64, hex, xor) must match the scalar code bit for bit
+local crypt = require "crypt"
+
+local detected = crypt.simd()
+local LEVELS = {"scalar"}
+if detected == "sse" or detected == "avx2" then
+    LEVELS[#LEVELS+1] = "sse"
+end
+if detected == "avx2" then
+    LEVELS[#LEVELS+1] = "avx2"
+end
+
+local function random_string(n)
+    local t = {}
+    for i=1,n do t[i] = string.char(math.random(0, 255)) end
+    return table.concat(t)
+end
+
+-- f() under each level, all results must be equal (errors included)
+local function same(f, ...)
+    local ref
+    for i, level in ipairs(LEVELS) do
+        crypt.simd(level)
+        local ok, ret = pcall(f, ...)
+        local v = ok and ret or "error"
+        if i == 1 then
+            ref = v
+        else
+            assert(v == ref, level.." mismatch")
+        end
+    end
+    crypt.simd(detected)
+    return ref
+end
+
+---------------- base64 ----------------
+local vectors = {
+    {"", ""},
+    {"f", "Zg=="},
+    {"fo", "Zm8="},
+    {"foo", "Zm9v"},
+    {"foobar", "Zm9vYmFy"},
+    {string.rep("\255", 30), string.rep("////", 10)},
+    {string.rep("\251\239\190", 16), string.rep("++++", 16)},
+}
+for _, v in ipairs(vectors) do
+    assert(same(crypt.base64encode, v[1]) == v[2], "base64encode "..v[2])
+    assert(same(crypt.base64decode, v[2]) == v[1], "base64decode "..v[2])
+    assert(same(crypt.base64decode, v[2], true) == v[1], "strict base64decode "..v[2])
+end
+
+math.randomseed(1248)
+-- lengths around the 12/24 byte encode and 16/32 char decode blocks
+for len=0,200 do
+    for _=1,5 do
+        local data = random_string(len)
+        local text = same(crypt.base64encode, data)
+        assert(same(crypt.base64decode, text) == data, "base64 round trip")
+        assert(same(crypt.base64decode, text, true) == data, "strict base64 round trip")
+    end
+end
+local big = random_string(100000)
+assert(same(crypt.base64decode, same(crypt.base64encode, big), true) == big)
+
+-- whitespace is skipped, unless strict
+local text = crypt.base64encode(random_string(300))
+local lines = text:gsub(string.rep(".", 76), "%0\r\n")
+assert(same(crypt.base64decode, lines) == crypt.base64decode(text))
+assert(same(crypt.base64decode, lines, true) == "error")
+assert(same(crypt.base64decode, text.." ", true) == "error")
+assert(same(crypt.base64decode, " "..text, true) == "error")
+
+-- one bad char anywhere, inside or after the vector blocks
+local chars = {" ", "\n", "=", "-", "_", "@", "[", "`", "{", ":", "\0", "\128", "\255"}
+for _=1,2000 do
+    local n = math.random(1, #text)
+    local bad = text:sub(1, n-1)..chars[math.random(#chars)]..text:sub(n+1)
+    same(crypt.base64decode, bad)
+    same(crypt.base64decode, bad, true)
+end
+
+-- padding in the middle only decodes in the default mode
+local mid = crypt.base64encode("ab")..crypt.base64encode(string.rep("x", 60))
+assert(same(crypt.base64decode, mid) == "ab"..string.rep("x", 60))
+assert(same(crypt.base64decode, mid, true) == "error")
+
+---------------- hex ----------------
+local function ref_hex(s)
+    return (s:gsub(".", function (c) return string.format("%02x", c:byte()) end))
+end
+
+-- lengths around the 16/32 byte encode and 32/64 char decode blocks
+for len=0,200 do
+    local data = random_string(len)
+    local hex = same(crypt.hexencode, data)
+    assert(hex == ref_hex(data), "hexencode")
+    assert(same(crypt.hexdecode, hex) == data, "hexdecode")
+end
+
+-- only lowercase [0-9a-f], anywhere in the text
+local hex = crypt.hexencode(random_string(100))
+for _, c in ipairs {"A", "F", "G", "g", "/", ":", "`", "@", " ", "\0", "\128", "\255"} do
+    for _, n in ipairs {1, 2, 17, 32, 33, 64, 65, 100, 128, 129, 199, 200} do
+        local bad = hex:sub(1, n-1)..c..hex:sub(n+1)
+        assert(same(crypt.hexdecode, bad) == "error", "hexdecode accepted "..string.format("%q", c))
+    end
+end
+assert(same(crypt.hexdecode, "abc") == "error")
+
+---------------- xor ----------------
+local function ref_xor(s, key)
+    local t = {}
+    for i=1, #s do
+        t[i] = string.char(s:byte(i) ~ key:byte((i-1) % #key + 1))
+    end
+    return table.concat(t)
+end
+
+-- short keys are expanded, long keys are used in runs
+for _, keysz in ipairs {1, 2, 3, 7, 16, 31, 32, 33, 100, 255, 256, 257, 600, 5000} do
+    local key = random_string(keysz)
+    for _, len in ipairs {0, 1, 15, 16, 31, 32, 33, 64, 255, 256, 511, 512, 513, 1000, 4099} do
+        local data = random_string(len)
+        assert(same(crypt.xor_str, data, key) == ref_xor(data, key), "xor_str")
+    end
+end
+assert(same(crypt.xor_str, "abc", "") == "error")
+
+print("test_crypt ok", detected)
@@ -0,0 +1,57 @@
+-- dh key exchange against known values, then handshake cost
+local crypt = require "crypt"
+
+-- produced by the original bit-serial mul_mod_p
+local vectors = {
+    {"3132333435363738", "a18e89af97222f0e", "37d8f0b09bd9ca54"},
+    {"0100000000000000", "0500000000000000", "45b4812bf7785815"},
+    {"ffffffffffffffff", "4e2ea6baf651b377", "c336438bf5041dca"},
+    {"c5ffffffffffffff", "0500000000000000", "45b4812bf7785815"},
+    {"6162636465666768", "c3c0880df34049bd", "594c69be340e57cf"},
+}
+
+local dhmul = crypt.dhmul()
+local MULS = {"serial"}
+if dhmul == "int128" then
+    MULS[2] = "int128"
+end
+
+-- every multiply gives the same keys
+for _, mul in ipairs(MULS) do
+    crypt.dhmul(mul)
+    for _, v in ipairs(vectors) do
+        local key = crypt.hexdecode(v[1])
+        local pub = crypt.dhexchange(key)
+        assert(crypt.hexencode(pub) == v[2], mul.." dhexchange mismatch")
+        assert(crypt.hexencode(crypt.dhsecret(pub, "zyxwvuts")) == v[3], mul.." dhsecret mismatch")
+    end
+end
+
+math.randomseed(1248)
+for i=1,1000 do
+    local a = crypt.randomkey()
+    local b = crypt.randomkey()
+    crypt.dhmul(MULS[1])
+    local sa = crypt.dhsecret(crypt.dhexchange(b), a)
+    crypt.dhmul(MULS[#MULS])
+    local sb = crypt.dhsecret(crypt.dhexchange(a), b)
+    assert(sa == sb, "dh secret disagree")
+end
+crypt.dhmul(dhmul)
+print("dh ok", dhmul)
+
+-- one client handshake is a dhexchange plus a dhsecret
+local count = 20000
+local key = crypt.randomkey()
+local server = crypt.dhexchange(crypt.randomkey())
+for _, mul in ipairs(MULS) do
+    crypt.dhmul(mul)
+    local t = os.clock()
+    for i=1,count do
+        crypt.dhexchange(key)
+        crypt.dhsecret(server, key)
+    end
+    t = os.clock() - t
+    print(string.format("dh handshake %s x %d: %.1f us/op", mul, count, t / count * 1e6))
+end
+crypt.dhmul(dhmul)
@@ -0,0 +1,36 @@
+-- histogram buckets, percentiles and merging of connection stats
+local stats = require "stats"
+
+local h = stats.histogram()
+for i=1, 1000 do
+    stats.observe(h, i)
+end
+assert(h.count == 1000 and h.min == 1 and h.max == 1000)
+assert(stats.mean(h) == 500.5)
+assert(stats.percentile(h, 0.5) == 512)
+assert(stats.percentile(h, 0.99) == 1000)
+
+stats.observe(h, 0)
+assert(h.buckets[1] == 1)
+assert(h.min == 0)
+
+-- counters add up, *_max keeps the largest, histograms merge bucket by bucket
+local a = {bytes_in = 10, send_queue_max = 300, update_us = stats.histogram()}
+local b = {bytes_in = 5, send_queue_max = 700, update_us = stats.histogram()}
+stats.observe(a.update_us, 3)
+stats.observe(b.update_us, 3000)
+
+local total = stats.merge(stats.merge({}, a), b)
+assert(total.bytes_in == 15)
+assert(total.send_queue_max == 700)
+assert(total.update_us.count == 2)
+assert(total.update_us.min == 3 and total.update_us.max == 3000)
+assert(stats.percentile(total.update_us, 0.5) == 4)
+
+-- merge copies, the sources are untouched
+assert(a.update_us.count == 1 and total.update_us ~= a.update_us)
+local c = stats.copy(total)
+stats.observe(c.update_us, 1)
+assert(total.update_us.count == 2)
+
+print("test_stats ok")